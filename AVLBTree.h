@@ -0,0 +1,1142 @@
+#ifndef AVLBTREE_H
+#define AVLBTREE_H
+
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "AVLNode.h"
+
+namespace AVL
+{
+
+/* In-node key search: the number of keys[0..n) before id, or before or
+ * equal to it when inclusive. keys has room for Order keys.
+ */
+template <typename Key, typename Compare, int Order>
+struct BTreeSearch
+{
+  static int CountBefore(const Key * keys, int n, const Key & id, bool inclusive, const Compare & comp)
+  {
+    int i = 0;
+
+    if(inclusive)
+    {
+      while(i < n && !comp(id, keys[i]))
+        i++;
+    }
+    else
+    {
+      while(i < n && comp(keys[i], id))
+        i++;
+    }
+
+    return i;
+  }
+};
+
+#ifdef __SSE2__
+// For 32-bit IDs a node's keys fill one cache line, and are compared with
+// id four at a time. All 16 are compared, whatever n is, so there are no
+// branches on the keys. keys has to be 16-byte aligned
+template <>
+struct BTreeSearch<unsigned int, std::less<unsigned int>, 16>
+{
+  static int CountBefore(const unsigned int * keys, int n, const unsigned int & id, bool inclusive,
+      const std::less<unsigned int> &)
+  {
+    // SSE2 only has signed compares, so both sides are offset by 2^31
+    const __m128i bias = _mm_set1_epi32(int(0x80000000u));
+    __m128i target = _mm_xor_si128(_mm_set1_epi32(int(id)), bias);
+    unsigned int less = 0, greater = 0;
+
+    for(int i = 0; i < 16; i += 4)
+    {
+      __m128i k = _mm_xor_si128(_mm_load_si128(reinterpret_cast<const __m128i *>(keys + i)), bias);
+
+      less |= unsigned(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(k, target)))) << i;
+      greater |= unsigned(_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, target)))) << i;
+    }
+
+    unsigned int used = (1u << n) - 1;
+
+    return inclusive ? n - __builtin_popcount(greater & used) : __builtin_popcount(less & used);
+  }
+};
+#endif
+
+/* A B+tree with the same operations as BasicTree (see AVLTree.h).
+ *
+ * Each node holds up to ORDER keys, which is as many as fit in one cache
+ * line, so a search takes about log_16(n) cache misses for 32-bit IDs
+ * rather than log_2(n). The keys and counts are all in the leaves, which
+ * are linked in key order for Next and Previous. Inner nodes keep the sum
+ * and the number of keys under each child, like the subtree sums and sizes
+ * of BasicTree, so ranges and order statistics take one descent.
+ *
+ * Every node but the root stays at least a quarter full: a node that drops
+ * below that takes keys from a sibling, or is merged in to it.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class BasicBTree
+{
+  public:
+    typedef Key key_type;
+    typedef Value value_type;
+    typedef typename ValueTraits<Value>::sum_type sum_type;
+
+    // Keys per node
+    static const int ORDER = sizeof(Key) <= 16 ? 64 / sizeof(Key) : 4;
+
+    BasicBTree();
+    ~BasicBTree();
+
+    void Clear();
+    void BuildFromSortedList(const std::vector<std::pair<Key, Value> > & list);
+
+    // Debugging functions
+    bool IsSane();
+    // Number of keys, levels (a single leaf is 1) and bytes in nodes
+    size_t Size() { return keyCount; }
+    int Levels() { return height + 1; }
+    size_t Bytes() { return BytesRec(root, height); }
+
+    // Same as in BasicTree
+    Value Increase(const Key & id, const Value & m);
+    Value Reduce(const Key & id, const Value & m);
+    bool Next(const Key & id, std::pair<Key, Value> & result);
+    Value Count(const Key & id);
+    bool Previous(const Key & id, std::pair<Key, Value> & result);
+    sum_type InRange(const Key & left, const Key & right);
+
+    int Rank(const Key & id);
+    bool Select(int k, std::pair<Key, Value> & result);
+    int CountDistinct(const Key & left, const Key & right);
+
+    sum_type Total() { return total; }
+    bool WeightedSelect(const sum_type & target, std::pair<Key, Value> & result);
+  private:
+    // not copyable
+    BasicBTree(const BasicBTree &);
+    BasicBTree & operator=(const BasicBTree &);
+
+    static const int MIN_KEYS = ORDER / 4;
+    static const int MAX_LEVELS = 32;
+
+    typedef BTreeSearch<Key, Compare, ORDER> Search;
+
+    // The keys come first, so they start on a cache line
+    struct alignas(64) Leaf
+    {
+      Key keys[ORDER];
+      Value counts[ORDER];
+      int n;
+      Leaf * prev;
+      Leaf * next;
+    };
+
+    // Child i holds the keys from keys[i - 1] up to, but not including,
+    // keys[i]
+    struct alignas(64) Inner
+    {
+      Key keys[ORDER];
+      int n;
+      void * children[ORDER + 1];
+      sum_type sums[ORDER + 1];
+      int sizes[ORDER + 1];
+    };
+
+    // The inner nodes on the way to a leaf, and the child taken in each
+    struct Path
+    {
+      Inner * nodes[MAX_LEVELS];
+      int index[MAX_LEVELS];
+      int depth;
+    };
+
+    // Goes down to the leaf that holds id, or would. When inclusive, ties
+    // with a separator go right, which is where id itself is. Otherwise
+    // they go left, towards the keys before id
+    Leaf * FindLeaf(const Key & id, bool inclusive, Path * path);
+
+    // Sum and number of the keys before id (or equal to it, when inclusive)
+    void Below(const Key & id, bool inclusive, sum_type & sum, int & size);
+
+    void AdjustPath(const Path & path, sum_type sum, int size);
+
+    void InsertInLeaf(Leaf * leaf, int pos, const Key & id, const Value & count, Path & path);
+    // Puts right in after child index[level] of the node at level in path,
+    // which is now left, splitting nodes up the path as needed
+    void InsertChild(Path & path, int level, const Key & separator, void * left, void * right, bool leaves);
+    // Fixes nodes on the path that dropped below MIN_KEYS after a remove
+    void FixUnderflow(Path & path);
+    // Evens out children l and l + 1 of parent, or merges them if they fit
+    // in one node
+    void MergeLeaves(Inner * parent, int l);
+    void MergeInner(Inner * parent, int l);
+    void RemoveChild(Inner * parent, int l);
+
+    static void LeafTotals(const Leaf * leaf, sum_type & sum, int & size);
+    static void InnerTotals(const Inner * inner, sum_type & sum, int & size);
+    void SetTotals(Inner * parent, int c, void * child, bool leaf);
+
+    void FreeRec(void * node, int level);
+    size_t BytesRec(void * node, int level);
+    bool IsSaneRec(void * node, int level, const Key * lower, const Key * upper,
+        sum_type & sum, int & size, Leaf * & last);
+  private:
+    // A leaf while height is 0. Never NULL
+    void * root;
+    // Levels of inner nodes above the leaves
+    int height;
+
+    size_t keyCount;
+    sum_type total;
+    Compare comp;
+};
+
+// The B+tree version of Tree
+typedef BasicBTree<ID, int> BTree;
+
+#define AVL_BTREE_TEMPLATE \
+  template <typename Key, typename Value, typename Compare>
+#define AVL_BTREE BasicBTree<Key, Value, Compare>
+
+AVL_BTREE_TEMPLATE
+AVL_BTREE::BasicBTree()
+  :root(new Leaf()), height(0), keyCount(0), total(0)
+{
+}
+
+AVL_BTREE_TEMPLATE
+AVL_BTREE::~BasicBTree()
+{
+  FreeRec(root, height);
+}
+
+AVL_BTREE_TEMPLATE
+void AVL_BTREE::FreeRec(void * node, int level)
+{
+  if(level == 0)
+  {
+    delete static_cast<Leaf *>(node);
+    return;
+  }
+
+  Inner * inner = static_cast<Inner *>(node);
+
+  for(int i = 0; i <= inner->n; i++)
+    FreeRec(inner->children[i], level - 1);
+
+  delete inner;
+}
+
+AVL_BTREE_TEMPLATE
+size_t AVL_BTREE::BytesRec(void * node, int level)
+{
+  if(level == 0)
+    return sizeof(Leaf);
+
+  Inner * inner = static_cast<Inner *>(node);
+  size_t bytes = sizeof(Inner);
+
+  for(int i = 0; i <= inner->n; i++)
+    bytes += BytesRec(inner->children[i], level - 1);
+
+  return bytes;
+}
+
+AVL_BTREE_TEMPLATE
+void AVL_BTREE::Clear()
+{
+  FreeRec(root, height);
+
+  root = new Leaf();
+  height = 0;
+  keyCount = 0;
+  total = 0;
+}
+
+AVL_BTREE_TEMPLATE
+void AVL_BTREE::BuildFromSortedList(const std::vector<std::pair<Key, Value> > & list)
+{
+  Clear();
+
+  if(list.empty())
+    return;
+
+  // Each level is spread evenly over as few nodes as will hold it, so
+  // they are all at least half full
+  std::vector<void *> level;
+  std::vector<Key> firstKeys;
+  size_t n = list.size();
+  size_t numLeaves = (n + ORDER - 1) / ORDER;
+  Leaf * prev = NULL;
+
+  delete static_cast<Leaf *>(root);
+
+  for(size_t i = 0, next = 0; i < numLeaves; i++)
+  {
+    Leaf * leaf = new Leaf();
+    size_t count = n / numLeaves + (i < n % numLeaves);
+
+    for(size_t j = 0; j < count; j++, next++)
+    {
+      leaf->keys[j] = list[next].first;
+      leaf->counts[j] = list[next].second;
+      total += ValueTraits<Value>::Weight(list[next].second);
+    }
+
+    leaf->n = count;
+    leaf->prev = prev;
+
+    if(prev)
+      prev->next = leaf;
+
+    prev = leaf;
+    level.push_back(leaf);
+    firstKeys.push_back(leaf->keys[0]);
+  }
+
+  keyCount = n;
+
+  while(level.size() > 1)
+  {
+    std::vector<void *> parents;
+    std::vector<Key> parentKeys;
+    size_t numParents = (level.size() + ORDER) / (ORDER + 1);
+
+    for(size_t i = 0, next = 0; i < numParents; i++)
+    {
+      Inner * inner = new Inner();
+      size_t count = level.size() / numParents + (i < level.size() % numParents);
+
+      for(size_t j = 0; j < count; j++, next++)
+      {
+        inner->children[j] = level[next];
+        SetTotals(inner, j, level[next], height == 0);
+
+        if(j > 0)
+          inner->keys[j - 1] = firstKeys[next];
+      }
+
+      inner->n = count - 1;
+      parents.push_back(inner);
+      parentKeys.push_back(firstKeys[next - count]);
+    }
+
+    level.swap(parents);
+    firstKeys.swap(parentKeys);
+    height++;
+  }
+
+  root = level[0];
+}
+
+AVL_BTREE_TEMPLATE
+void AVL_BTREE::LeafTotals(const Leaf * leaf, sum_type & sum, int & size)
+{
+  sum = 0;
+  size = leaf->n;
+
+  for(int i = 0; i < leaf->n; i++)
+    sum += ValueTraits<Value>::Weight(leaf->counts[i]);
+}
+
+AVL_BTREE_TEMPLATE
+void AVL_BTREE::InnerTotals(const Inner * inner, sum_type & sum, int & size)
+{
+  sum = 0;
+  size = 0;
+
+  for(int i = 0; i <= inner->n; i++)
+  {
+    sum += inner->sums[i];
+    size += inner->sizes[i];
+  }
+}
+
+AVL_BTREE_TEMPLATE
+void AVL_BTREE::SetTotals(Inner * parent, int c, void * child, bool leaf)
+{
+  if(leaf)
+    LeafTotals(static_cast<Leaf *>(child), parent->sums[c], parent->sizes[c]);
+  else
+    InnerTotals(static_cast<Inner *>(child), parent->sums[c], parent->sizes[c]);
+}
+
+AVL_BTREE_TEMPLATE
+typename AVL_BTREE::Leaf * AVL_BTREE::FindLeaf(const Key & id, bool inclusive, Path * path)
+{
+  void * node = root;
+
+  if(path)
+    path->depth = 0;
+
+  for(int level = height; level > 0; level--)
+  {
+    Inner * inner = static_cast<Inner *>(node);
+    int c = Search::CountBefore(inner->keys, inner->n, id, inclusive, comp);
+
+    if(path)
+    {
+      path->nodes[path->depth] = inner;
+      path->index[path->depth] = c;
+      path->depth++;
+    }
+
+    node = inner->children[c];
+  }
+
+  return static_cast<Leaf *>(node);
+}
+
+AVL_BTREE_TEMPLATE
+void AVL_BTREE::AdjustPath(const Path & path, sum_type sum, int size)
+{
+  for(int i = 0; i < path.depth; i++)
+  {
+    path.nodes[i]->sums[path.index[i]] += sum;
+    path.nodes[i]->sizes[path.index[i]] += size;
+  }
+}
+
+AVL_BTREE_TEMPLATE
+Value AVL_BTREE::Increase(const Key & id, const Value & m)
+{
+  // ignore weird counts
+  if(!(m > Value()))
+    return Value();
+
+  Path path;
+  Leaf * leaf = FindLeaf(id, true, &path);
+  int pos = Search::CountBefore(leaf->keys, leaf->n, id, false, comp);
+
+  if(pos < leaf->n && !comp(id, leaf->keys[pos]))
+  {
+    Value old = leaf->counts[pos];
+    leaf->counts[pos] += m;
+
+    sum_type delta = ValueTraits<Value>::Weight(leaf->counts[pos]) - ValueTraits<Value>::Weight(old);
+    AdjustPath(path, delta, 0);
+    total += delta;
+
+    return leaf->counts[pos];
+  }
+
+  AdjustPath(path, ValueTraits<Value>::Weight(m), 1);
+  total += ValueTraits<Value>::Weight(m);
+  keyCount++;
+
+  InsertInLeaf(leaf, pos, id, m, path);
+
+  return m;
+}
+
+AVL_BTREE_TEMPLATE
+void AVL_BTREE::InsertInLeaf(Leaf * leaf, int pos, const Key & id, const Value & count, Path & path)
+{
+  if(leaf->n < ORDER)
+  {
+    for(int i = leaf->n; i > pos; i--)
+    {
+      leaf->keys[i] = leaf->keys[i - 1];
+      leaf->counts[i] = leaf->counts[i - 1];
+    }
+
+    leaf->keys[pos] = id;
+    leaf->counts[pos] = count;
+    leaf->n++;
+    return;
+  }
+
+  // Full. The upper half moves to a new leaf on the right
+  Key keys[ORDER + 1];
+  Value counts[ORDER + 1];
+
+  for(int i = 0, j = 0; i <= ORDER; i++)
+  {
+    if(i == pos)
+    {
+      keys[i] = id;
+      counts[i] = count;
+    }
+    else
+    {
+      keys[i] = leaf->keys[j];
+      counts[i] = leaf->counts[j];
+      j++;
+    }
+  }
+
+  Leaf * right = new Leaf();
+  int half = (ORDER + 1) / 2;
+
+  for(int i = 0; i < half; i++)
+  {
+    leaf->keys[i] = keys[i];
+    leaf->counts[i] = counts[i];
+  }
+
+  for(int i = half; i <= ORDER; i++)
+  {
+    right->keys[i - half] = keys[i];
+    right->counts[i - half] = counts[i];
+  }
+
+  leaf->n = half;
+  right->n = ORDER + 1 - half;
+
+  right->prev = leaf;
+  right->next = leaf->next;
+
+  if(leaf->next)
+    leaf->next->prev = right;
+
+  leaf->next = right;
+
+  InsertChild(path, path.depth - 1, right->keys[0], leaf, right, true);
+}
+
+AVL_BTREE_TEMPLATE
+void AVL_BTREE::InsertChild(Path & path, int level, const Key & separator, void * left, void * right, bool leaves)
+{
+  if(level < 0)
+  {
+    // The root split
+    Inner * inner = new Inner();
+
+    inner->n = 1;
+    inner->keys[0] = separator;
+    inner->children[0] = left;
+    inner->children[1] = right;
+    SetTotals(inner, 0, left, leaves);
+    SetTotals(inner, 1, right, leaves);
+
+    root = inner;
+    height++;
+    return;
+  }
+
+  Inner * inner = path.nodes[level];
+  int c = path.index[level];
+
+  if(inner->n < ORDER)
+  {
+    for(int i = inner->n; i > c; i--)
+    {
+      inner->keys[i] = inner->keys[i - 1];
+      inner->children[i + 1] = inner->children[i];
+      inner->sums[i + 1] = inner->sums[i];
+      inner->sizes[i + 1] = inner->sizes[i];
+    }
+
+    inner->keys[c] = separator;
+    inner->children[c + 1] = right;
+    SetTotals(inner, c, left, leaves);
+    SetTotals(inner, c + 1, right, leaves);
+    inner->n++;
+    return;
+  }
+
+  // Full. The middle key moves up and the keys after it go to a new node
+  Key keys[ORDER + 1];
+  void * children[ORDER + 2];
+
+  for(int i = 0, j = 0; i <= ORDER; i++)
+    keys[i] = i == c ? separator : inner->keys[j++];
+
+  for(int i = 0, j = 0; i <= ORDER + 1; i++)
+    children[i] = i == c + 1 ? right : inner->children[j++];
+
+  // The sums are worked out again from the children, so the two that
+  // changed get theirs
+  sum_type sums[ORDER + 2];
+  int sizes[ORDER + 2];
+
+  for(int i = 0, j = 0; i <= ORDER + 1; i++)
+  {
+    if(i == c + 1)
+      continue;
+
+    sums[i] = inner->sums[j];
+    sizes[i] = inner->sizes[j];
+    j++;
+  }
+
+  Inner * upper = new Inner();
+  int half = (ORDER + 1) / 2;
+
+  inner->n = half;
+  upper->n = ORDER - half;
+
+  for(int i = 0; i <= half; i++)
+  {
+    inner->children[i] = children[i];
+    inner->sums[i] = sums[i];
+    inner->sizes[i] = sizes[i];
+
+    if(i < half)
+      inner->keys[i] = keys[i];
+  }
+
+  for(int i = half + 1; i <= ORDER + 1; i++)
+  {
+    upper->children[i - half - 1] = children[i];
+    upper->sums[i - half - 1] = sums[i];
+    upper->sizes[i - half - 1] = sizes[i];
+
+    if(i <= ORDER)
+      upper->keys[i - half - 1] = keys[i];
+  }
+
+  // left and right may have landed in either half
+  for(int i = 0; i <= inner->n; i++)
+  {
+    if(inner->children[i] == left || inner->children[i] == right)
+      SetTotals(inner, i, inner->children[i], leaves);
+  }
+
+  for(int i = 0; i <= upper->n; i++)
+  {
+    if(upper->children[i] == left || upper->children[i] == right)
+      SetTotals(upper, i, upper->children[i], leaves);
+  }
+
+  InsertChild(path, level - 1, keys[half], inner, upper, false);
+}
+
+AVL_BTREE_TEMPLATE
+Value AVL_BTREE::Reduce(const Key & id, const Value & m)
+{
+  // ignore weird counts
+  if(!(m > Value()))
+    return Value();
+
+  Path path;
+  Leaf * leaf = FindLeaf(id, true, &path);
+  int pos = Search::CountBefore(leaf->keys, leaf->n, id, false, comp);
+
+  if(pos == leaf->n || comp(id, leaf->keys[pos])) // no match
+    return Value();
+
+  Value old = leaf->counts[pos];
+  Value newCount = old - m;
+
+  // If the new count is above the threshold, then keep the key
+  if(newCount > Value())
+  {
+    leaf->counts[pos] = newCount;
+
+    sum_type delta = ValueTraits<Value>::Weight(newCount) - ValueTraits<Value>::Weight(old);
+    AdjustPath(path, delta, 0);
+    total += delta;
+
+    return newCount;
+  }
+
+  AdjustPath(path, -ValueTraits<Value>::Weight(old), -1);
+  total -= ValueTraits<Value>::Weight(old);
+  keyCount--;
+
+  for(int i = pos; i < leaf->n - 1; i++)
+  {
+    leaf->keys[i] = leaf->keys[i + 1];
+    leaf->counts[i] = leaf->counts[i + 1];
+  }
+
+  leaf->n--;
+
+  FixUnderflow(path);
+
+  return Value();
+}
+
+AVL_BTREE_TEMPLATE
+void AVL_BTREE::FixUnderflow(Path & path)
+{
+  for(int level = path.depth - 1; level >= 0; level--)
+  {
+    Inner * parent = path.nodes[level];
+    int c = path.index[level];
+    void * child = parent->children[c];
+    int n = level == path.depth - 1 ? static_cast<Leaf *>(child)->n : static_cast<Inner *>(child)->n;
+
+    if(n >= MIN_KEYS)
+      return;
+
+    // Paired with the sibling on the left, unless it is the first child
+    int l = c > 0 ? c - 1 : c;
+
+    if(level == path.depth - 1)
+      MergeLeaves(parent, l);
+    else
+      MergeInner(parent, l);
+  }
+
+  // The root is left with one child when its last two merge
+  if(height > 0 && static_cast<Inner *>(root)->n == 0)
+  {
+    Inner * old = static_cast<Inner *>(root);
+
+    root = old->children[0];
+    height--;
+    delete old;
+  }
+}
+
+AVL_BTREE_TEMPLATE
+void AVL_BTREE::RemoveChild(Inner * parent, int l)
+{
+  parent->sums[l] += parent->sums[l + 1];
+  parent->sizes[l] += parent->sizes[l + 1];
+
+  for(int i = l; i < parent->n - 1; i++)
+  {
+    parent->keys[i] = parent->keys[i + 1];
+    parent->children[i + 1] = parent->children[i + 2];
+    parent->sums[i + 1] = parent->sums[i + 2];
+    parent->sizes[i + 1] = parent->sizes[i + 2];
+  }
+
+  parent->n--;
+}
+
+AVL_BTREE_TEMPLATE
+void AVL_BTREE::MergeLeaves(Inner * parent, int l)
+{
+  Leaf * a = static_cast<Leaf *>(parent->children[l]);
+  Leaf * b = static_cast<Leaf *>(parent->children[l + 1]);
+  int n = a->n + b->n;
+
+  if(n <= ORDER)
+  {
+    for(int i = 0; i < b->n; i++)
+    {
+      a->keys[a->n + i] = b->keys[i];
+      a->counts[a->n + i] = b->counts[i];
+    }
+
+    a->n = n;
+    a->next = b->next;
+
+    if(b->next)
+      b->next->prev = a;
+
+    delete b;
+    RemoveChild(parent, l);
+    return;
+  }
+
+  Key keys[2 * ORDER];
+  Value counts[2 * ORDER];
+
+  for(int i = 0; i < a->n; i++)
+  {
+    keys[i] = a->keys[i];
+    counts[i] = a->counts[i];
+  }
+
+  for(int i = 0; i < b->n; i++)
+  {
+    keys[a->n + i] = b->keys[i];
+    counts[a->n + i] = b->counts[i];
+  }
+
+  a->n = n / 2;
+  b->n = n - a->n;
+
+  for(int i = 0; i < a->n; i++)
+  {
+    a->keys[i] = keys[i];
+    a->counts[i] = counts[i];
+  }
+
+  for(int i = 0; i < b->n; i++)
+  {
+    b->keys[i] = keys[a->n + i];
+    b->counts[i] = counts[a->n + i];
+  }
+
+  parent->keys[l] = b->keys[0];
+  SetTotals(parent, l, a, true);
+  SetTotals(parent, l + 1, b, true);
+}
+
+AVL_BTREE_TEMPLATE
+void AVL_BTREE::MergeInner(Inner * parent, int l)
+{
+  Inner * a = static_cast<Inner *>(parent->children[l]);
+  Inner * b = static_cast<Inner *>(parent->children[l + 1]);
+  // The separator between them comes down between their keys
+  int n = a->n + 1 + b->n;
+
+  Key keys[2 * ORDER + 1];
+  void * children[2 * ORDER + 2];
+  sum_type sums[2 * ORDER + 2];
+  int sizes[2 * ORDER + 2];
+
+  for(int i = 0; i <= a->n; i++)
+  {
+    children[i] = a->children[i];
+    sums[i] = a->sums[i];
+    sizes[i] = a->sizes[i];
+
+    if(i < a->n)
+      keys[i] = a->keys[i];
+  }
+
+  keys[a->n] = parent->keys[l];
+
+  for(int i = 0; i <= b->n; i++)
+  {
+    children[a->n + 1 + i] = b->children[i];
+    sums[a->n + 1 + i] = b->sums[i];
+    sizes[a->n + 1 + i] = b->sizes[i];
+
+    if(i < b->n)
+      keys[a->n + 1 + i] = b->keys[i];
+  }
+
+  if(n <= ORDER)
+  {
+    for(int i = 0; i <= n; i++)
+    {
+      a->children[i] = children[i];
+      a->sums[i] = sums[i];
+      a->sizes[i] = sizes[i];
+
+      if(i < n)
+        a->keys[i] = keys[i];
+    }
+
+    a->n = n;
+
+    delete b;
+    RemoveChild(parent, l);
+    return;
+  }
+
+  // Too many for one node. The middle key goes back up
+  int half = n / 2;
+
+  a->n = half;
+  b->n = n - half - 1;
+
+  for(int i = 0; i <= half; i++)
+  {
+    a->children[i] = children[i];
+    a->sums[i] = sums[i];
+    a->sizes[i] = sizes[i];
+
+    if(i < half)
+      a->keys[i] = keys[i];
+  }
+
+  for(int i = 0; i <= b->n; i++)
+  {
+    b->children[i] = children[half + 1 + i];
+    b->sums[i] = sums[half + 1 + i];
+    b->sizes[i] = sizes[half + 1 + i];
+
+    if(i < b->n)
+      b->keys[i] = keys[half + 1 + i];
+  }
+
+  parent->keys[l] = keys[half];
+  SetTotals(parent, l, a, false);
+  SetTotals(parent, l + 1, b, false);
+}
+
+AVL_BTREE_TEMPLATE
+bool AVL_BTREE::Next(const Key & id, std::pair<Key, Value> & result)
+{
+  Leaf * leaf = FindLeaf(id, true, NULL);
+  int pos = Search::CountBefore(leaf->keys, leaf->n, id, true, comp);
+
+  // Every leaf but the root has keys, so the next one starts with the answer
+  if(pos == leaf->n)
+  {
+    leaf = leaf->next;
+    pos = 0;
+
+    if(!leaf)
+      return false;
+  }
+
+  result = std::pair<Key, Value>(leaf->keys[pos], leaf->counts[pos]);
+  return true;
+}
+
+AVL_BTREE_TEMPLATE
+Value AVL_BTREE::Count(const Key & id)
+{
+  Leaf * leaf = FindLeaf(id, true, NULL);
+  int pos = Search::CountBefore(leaf->keys, leaf->n, id, false, comp);
+
+  if(pos == leaf->n || comp(id, leaf->keys[pos]))
+    return Value();
+
+  return leaf->counts[pos];
+}
+
+AVL_BTREE_TEMPLATE
+bool AVL_BTREE::Previous(const Key & id, std::pair<Key, Value> & result)
+{
+  Leaf * leaf = FindLeaf(id, false, NULL);
+  int pos = Search::CountBefore(leaf->keys, leaf->n, id, false, comp);
+
+  if(pos == 0)
+  {
+    leaf = leaf->prev;
+
+    if(!leaf)
+      return false;
+
+    pos = leaf->n;
+  }
+
+  result = std::pair<Key, Value>(leaf->keys[pos - 1], leaf->counts[pos - 1]);
+  return true;
+}
+
+AVL_BTREE_TEMPLATE
+void AVL_BTREE::Below(const Key & id, bool inclusive, sum_type & sum, int & size)
+{
+  void * node = root;
+
+  sum = 0;
+  size = 0;
+
+  // Whichever way ties go, everything in the children to the left is
+  // before id
+  for(int level = height; level > 0; level--)
+  {
+    Inner * inner = static_cast<Inner *>(node);
+    int c = Search::CountBefore(inner->keys, inner->n, id, inclusive, comp);
+
+    for(int i = 0; i < c; i++)
+    {
+      sum += inner->sums[i];
+      size += inner->sizes[i];
+    }
+
+    node = inner->children[c];
+  }
+
+  Leaf * leaf = static_cast<Leaf *>(node);
+  int pos = Search::CountBefore(leaf->keys, leaf->n, id, inclusive, comp);
+
+  for(int i = 0; i < pos; i++)
+    sum += ValueTraits<Value>::Weight(leaf->counts[i]);
+
+  size += pos;
+}
+
+AVL_BTREE_TEMPLATE
+typename AVL_BTREE::sum_type AVL_BTREE::InRange(const Key & left, const Key & right)
+{
+  sum_type upper, lower;
+  int size;
+
+  if(comp(right, left))
+    return 0;
+
+  Below(right, true, upper, size);
+  Below(left, false, lower, size);
+
+  return upper - lower;
+}
+
+AVL_BTREE_TEMPLATE
+int AVL_BTREE::Rank(const Key & id)
+{
+  sum_type sum;
+  int size;
+
+  Below(id, true, sum, size);
+
+  return size;
+}
+
+AVL_BTREE_TEMPLATE
+int AVL_BTREE::CountDistinct(const Key & left, const Key & right)
+{
+  sum_type sum;
+  int upper, lower;
+
+  if(comp(right, left))
+    return 0;
+
+  Below(right, true, sum, upper);
+  Below(left, false, sum, lower);
+
+  return upper - lower;
+}
+
+AVL_BTREE_TEMPLATE
+bool AVL_BTREE::Select(int k, std::pair<Key, Value> & result)
+{
+  if(k < 1 || size_t(k) > keyCount)
+    return false;
+
+  void * node = root;
+
+  for(int level = height; level > 0; level--)
+  {
+    Inner * inner = static_cast<Inner *>(node);
+    int c = 0;
+
+    while(c < inner->n && k > inner->sizes[c])
+      k -= inner->sizes[c++];
+
+    node = inner->children[c];
+  }
+
+  Leaf * leaf = static_cast<Leaf *>(node);
+
+  result = std::pair<Key, Value>(leaf->keys[k - 1], leaf->counts[k - 1]);
+  return true;
+}
+
+AVL_BTREE_TEMPLATE
+bool AVL_BTREE::WeightedSelect(const sum_type & target, std::pair<Key, Value> & result)
+{
+  if(!keyCount || total < target)
+    return false;
+
+  void * node = root;
+  sum_type remaining = target;
+
+  // As in BasicTree, a target of 0 or less ends up at the smallest key,
+  // and the last child is taken rather than walk off the tree
+  for(int level = height; level > 0; level--)
+  {
+    Inner * inner = static_cast<Inner *>(node);
+    int c = 0;
+
+    while(c < inner->n && remaining > inner->sums[c])
+      remaining -= inner->sums[c++];
+
+    node = inner->children[c];
+  }
+
+  Leaf * leaf = static_cast<Leaf *>(node);
+  int pos = 0;
+
+  while(pos < leaf->n - 1 && remaining > ValueTraits<Value>::Weight(leaf->counts[pos]))
+    remaining -= ValueTraits<Value>::Weight(leaf->counts[pos++]);
+
+  result = std::pair<Key, Value>(leaf->keys[pos], leaf->counts[pos]);
+  return true;
+}
+
+AVL_BTREE_TEMPLATE
+bool AVL_BTREE::IsSane()
+{
+  sum_type sum;
+  int size;
+  Leaf * last = NULL;
+
+  if(!IsSaneRec(root, height, NULL, NULL, sum, size, last))
+    return false;
+
+  if(last && last->next)
+  {
+    printf("Last leaf links to another\n");
+    return false;
+  }
+
+  if(sum != total || size_t(size) != keyCount)
+  {
+    printf("Tree totals are wrong\n");
+    return false;
+  }
+
+  return true;
+}
+
+AVL_BTREE_TEMPLATE
+bool AVL_BTREE::IsSaneRec(void * node, int level, const Key * lower, const Key * upper,
+    sum_type & sum, int & size, Leaf * & last)
+{
+  bool isRoot = node == root;
+
+  if(level == 0)
+  {
+    Leaf * leaf = static_cast<Leaf *>(node);
+
+    if(leaf->n > ORDER || (!isRoot && leaf->n < MIN_KEYS))
+    {
+      printf("Leaf has %d keys\n", leaf->n);
+      return false;
+    }
+
+    if(leaf->prev != last || (last && last->next != leaf))
+    {
+      printf("Leaf links are broken\n");
+      return false;
+    }
+
+    for(int i = 0; i < leaf->n; i++)
+    {
+      if((i > 0 && !comp(leaf->keys[i - 1], leaf->keys[i])) ||
+          (lower && comp(leaf->keys[i], *lower)) || (upper && !comp(leaf->keys[i], *upper)) ||
+          !(leaf->counts[i] > Value()))
+      {
+        printf("Leaf key %d is out of order or has no count\n", i);
+        return false;
+      }
+    }
+
+    LeafTotals(leaf, sum, size);
+    last = leaf;
+
+    return true;
+  }
+
+  Inner * inner = static_cast<Inner *>(node);
+
+  if(inner->n > ORDER || inner->n < (isRoot ? 1 : MIN_KEYS))
+  {
+    printf("Inner node has %d keys\n", inner->n);
+    return false;
+  }
+
+  sum = 0;
+  size = 0;
+
+  for(int i = 0; i <= inner->n; i++)
+  {
+    sum_type childSum;
+    int childSize;
+
+    if(!IsSaneRec(inner->children[i], level - 1, i > 0 ? &inner->keys[i - 1] : lower,
+          i < inner->n ? &inner->keys[i] : upper, childSum, childSize, last))
+      return false;
+
+    if(childSum != inner->sums[i] || childSize != inner->sizes[i])
+    {
+      printf("Wrong totals for child %d\n", i);
+      return false;
+    }
+
+    sum += childSum;
+    size += childSize;
+  }
+
+  return true;
+}
+
+#undef AVL_BTREE
+#undef AVL_BTREE_TEMPLATE
+
+}
+
+#endif
@@ -0,0 +1,395 @@
+#ifndef AVLCONCURRENTTREE_H
+#define AVLCONCURRENTTREE_H
+
+#include "AVLTree.h"
+#include "AVLEpoch.h"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace AVL
+{
+
+/* A tree that any number of threads can read while one thread at a time
+ * writes to it.
+ *
+ * Writers (Increase and Reduce) are serialized by a mutex and bump a
+ * sequence number before and after they touch the tree. Readers take no
+ * lock: they note the sequence number, search the nodes while the writer
+ * may be rebalancing underneath them, and keep the answer only if the
+ * sequence number didn't change in the meantime. Otherwise they try again.
+ * A search that is led astray by a rotation is cut off after MAX_HEIGHT
+ * steps, so it can't loop.
+ *
+ * Nodes removed by Reduce stay untouched until every reader that could
+ * have reached them has finished (see EpochManager), so a reader never
+ * follows a link in to a node that was reused for something else.
+ *
+ * A reader that keeps losing to the writer eventually takes the writer's
+ * mutex for one attempt, so a busy writer can't starve it.
+ *
+ * The nodes' links, counts and sums and the root are stored by the writer
+ * as relaxed atomics (see storeShared in AVLNode.h), and the readers load
+ * them the same way, so a torn or stale value is only ever a reason to
+ * retry. Keys, counts and their sums have to be scalars for this.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class ConcurrentTree
+{
+  public:
+    typedef BasicTree<Key, Value, Compare, RetiringPool<Node<Key, Value> > > tree_type;
+    typedef Key key_type;
+    typedef Value value_type;
+    typedef typename tree_type::sum_type sum_type;
+
+    static_assert(std::is_scalar<Key>::value && std::is_scalar<Value>::value &&
+        std::is_scalar<sum_type>::value, "concurrent trees need scalar keys, counts and sums");
+
+    ConcurrentTree();
+
+    // These wait for every reader to get out of the tree first
+    void Clear();
+    void BuildFromSortedList(const std::vector<std::pair<Key, Value> > & list);
+
+    // Writers. Same behaviour as in BasicTree
+    Value Increase(const Key & id, const Value & m);
+    Value Reduce(const Key & id, const Value & m);
+
+    // Readers. Same behaviour as in BasicTree. Safe to call from any
+    // number of threads while a writer runs
+    Value Count(const Key & id);
+    bool Next(const Key & id, std::pair<Key, Value> & result);
+    bool Previous(const Key & id, std::pair<Key, Value> & result);
+    sum_type InRange(const Key & left, const Key & right);
+  private:
+    typedef typename tree_type::Node_t Node_t;
+
+    // Runs op until it completes without overlapping a write
+    template <typename Op>
+    void Read(Op op);
+    void BeginWrite();
+    void EndWrite();
+
+    // Single search attempts. They return false if they ran too long,
+    // which can only happen when a write got in the way
+    bool TryCount(const Key & id, Value & result);
+    bool TryNext(const Key & id, NodeRef & result);
+    bool TryPrevious(const Key & id, NodeRef & result);
+    bool TrySumBelow(const Key & id, bool inclusive, sum_type & result);
+  private:
+    // not copyable
+    ConcurrentTree(const ConcurrentTree &);
+    ConcurrentTree & operator=(const ConcurrentTree &);
+  private:
+    static const int OPTIMISTIC_READS = 16;
+
+    tree_type tree;
+    EpochManager epochs;
+    std::mutex writeLock;
+
+    // Odd while a write is in progress
+    alignas(64) std::atomic<uint64_t> sequence;
+};
+
+#define AVL_CONCURRENT_TREE_TEMPLATE \
+  template <typename Key, typename Value, typename Compare>
+#define AVL_CONCURRENT_TREE ConcurrentTree<Key, Value, Compare>
+
+AVL_CONCURRENT_TREE_TEMPLATE
+AVL_CONCURRENT_TREE::ConcurrentTree()
+  :sequence(0)
+{
+  tree.pool.SetEpochManager(&epochs);
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+void AVL_CONCURRENT_TREE::Clear()
+{
+  std::lock_guard<std::mutex> lock(writeLock);
+
+  // Readers that start now see the write and back off without touching
+  // a node. Wait for the ones already searching
+  BeginWrite();
+  epochs.WaitForReaders();
+  tree.Clear();
+  EndWrite();
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+void AVL_CONCURRENT_TREE::BuildFromSortedList(const std::vector<std::pair<Key, Value> > & list)
+{
+  std::lock_guard<std::mutex> lock(writeLock);
+
+  BeginWrite();
+  epochs.WaitForReaders();
+  tree.BuildFromSortedList(list);
+  EndWrite();
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+Value AVL_CONCURRENT_TREE::Increase(const Key & id, const Value & m)
+{
+  std::lock_guard<std::mutex> lock(writeLock);
+
+  BeginWrite();
+  Value result = tree.Increase(id, m);
+  EndWrite();
+
+  return result;
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+Value AVL_CONCURRENT_TREE::Reduce(const Key & id, const Value & m)
+{
+  std::lock_guard<std::mutex> lock(writeLock);
+
+  BeginWrite();
+  Value result = tree.Reduce(id, m);
+  EndWrite();
+
+  // Recycle whatever earlier removals no reader can see any more
+  tree.pool.Reclaim();
+
+  return result;
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+Value AVL_CONCURRENT_TREE::Count(const Key & id)
+{
+  Value result = Value();
+
+  Read([&]() { return TryCount(id, result); });
+
+  return result;
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+bool AVL_CONCURRENT_TREE::Next(const Key & id, std::pair<Key, Value> & result)
+{
+  bool found = false;
+
+  Read([&]() {
+    NodeRef node;
+
+    if(!TryNext(id, node))
+      return false;
+
+    // copy the answer out before it is validated
+    if((found = (node != NO_NODE)))
+      result = std::pair<Key, Value>(tree.Get(node)->getId(), tree.Get(node)->loadCount());
+
+    return true;
+  });
+
+  return found;
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+bool AVL_CONCURRENT_TREE::Previous(const Key & id, std::pair<Key, Value> & result)
+{
+  bool found = false;
+
+  Read([&]() {
+    NodeRef node;
+
+    if(!TryPrevious(id, node))
+      return false;
+
+    if((found = (node != NO_NODE)))
+      result = std::pair<Key, Value>(tree.Get(node)->getId(), tree.Get(node)->loadCount());
+
+    return true;
+  });
+
+  return found;
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+typename AVL_CONCURRENT_TREE::sum_type AVL_CONCURRENT_TREE::InRange(const Key & left, const Key & right)
+{
+  if(tree.comp(right, left))
+    return 0;
+
+  sum_type below, upTo;
+
+  // Both prefix sums have to come from the same version of the tree
+  Read([&]() {
+    return TrySumBelow(right, true, upTo) && TrySumBelow(left, false, below);
+  });
+
+  return upTo - below;
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+template <typename Op>
+void AVL_CONCURRENT_TREE::Read(Op op)
+{
+  for(int attempt = 0; attempt < OPTIMISTIC_READS; attempt++)
+  {
+    epochs.Enter();
+
+    uint64_t before = sequence.load(std::memory_order_acquire);
+
+    if(!(before & 1) && op())
+    {
+      // Our loads of the nodes have to happen before we check again
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      if(sequence.load(std::memory_order_relaxed) == before)
+      {
+        epochs.Exit();
+        return;
+      }
+    }
+
+    epochs.Exit();
+    std::this_thread::yield();
+  }
+
+  // Keep the writer out for one attempt
+  std::lock_guard<std::mutex> lock(writeLock);
+
+  op();
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+void AVL_CONCURRENT_TREE::BeginWrite()
+{
+  sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+  // None of the writer's stores to the nodes may pass the odd sequence
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+void AVL_CONCURRENT_TREE::EndWrite()
+{
+  sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+bool AVL_CONCURRENT_TREE::TryCount(const Key & id, Value & result)
+{
+  NodeRef cur = loadShared(tree.root, __ATOMIC_ACQUIRE);
+
+  result = Value();
+
+  for(int steps = 0; cur != NO_NODE; steps++)
+  {
+    if(steps == MAX_HEIGHT)
+      return false;
+
+    Node_t * n = tree.Get(cur);
+
+    if(tree.comp(n->getId(), id))
+      cur = n->loadRight();
+    else if(tree.comp(id, n->getId()))
+      cur = n->loadLeft();
+    else
+    {
+      result = n->loadCount();
+      break;
+    }
+  }
+
+  return true;
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+bool AVL_CONCURRENT_TREE::TryNext(const Key & id, NodeRef & result)
+{
+  NodeRef cur = loadShared(tree.root, __ATOMIC_ACQUIRE);
+
+  result = NO_NODE;
+
+  for(int steps = 0; cur != NO_NODE; steps++)
+  {
+    if(steps == MAX_HEIGHT)
+      return false;
+
+    Node_t * n = tree.Get(cur);
+
+    if(tree.comp(id, n->getId()))
+    {
+      result = cur;
+      cur = n->loadLeft();
+    }
+    else
+    {
+      cur = n->loadRight();
+    }
+  }
+
+  return true;
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+bool AVL_CONCURRENT_TREE::TryPrevious(const Key & id, NodeRef & result)
+{
+  NodeRef cur = loadShared(tree.root, __ATOMIC_ACQUIRE);
+
+  result = NO_NODE;
+
+  for(int steps = 0; cur != NO_NODE; steps++)
+  {
+    if(steps == MAX_HEIGHT)
+      return false;
+
+    Node_t * n = tree.Get(cur);
+
+    if(tree.comp(n->getId(), id))
+    {
+      result = cur;
+      cur = n->loadRight();
+    }
+    else
+    {
+      cur = n->loadLeft();
+    }
+  }
+
+  return true;
+}
+
+AVL_CONCURRENT_TREE_TEMPLATE
+bool AVL_CONCURRENT_TREE::TrySumBelow(const Key & id, bool inclusive, sum_type & result)
+{
+  NodeRef cur = loadShared(tree.root, __ATOMIC_ACQUIRE);
+
+  result = 0;
+
+  for(int steps = 0; cur != NO_NODE; steps++)
+  {
+    if(steps == MAX_HEIGHT)
+      return false;
+
+    Node_t * n = tree.Get(cur);
+
+    if(tree.comp(n->getId(), id) || (inclusive && !tree.comp(id, n->getId())))
+    {
+      NodeRef left = n->loadLeft();
+
+      result += (left ? tree.Get(left)->loadSum() : 0) + ValueTraits<Value>::Weight(n->loadCount());
+      cur = n->loadRight();
+    }
+    else
+    {
+      cur = n->loadLeft();
+    }
+  }
+
+  return true;
+}
+
+#undef AVL_CONCURRENT_TREE
+#undef AVL_CONCURRENT_TREE_TEMPLATE
+
+}
+
+#endif
@@ -0,0 +1,215 @@
+#ifndef AVLEPOCH_H
+#define AVLEPOCH_H
+
+#include "AVLNodePool.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace AVL
+{
+
+// Upper bound on the number of threads that use concurrent trees at once
+const int MAX_THREADS = 128;
+
+/* A small process-wide index for the calling thread, handed out on first
+ * use and given back when the thread exits. Epoch managers use it to find
+ * the thread's slot without a lookup.
+ */
+class ThreadSlot
+{
+  public:
+    static int Index()
+    {
+      static thread_local ThreadSlot slot;
+
+      return slot.index;
+    }
+  private:
+    ThreadSlot()
+    {
+      for(index = 0; index < MAX_THREADS; index++)
+      {
+        bool expected = false;
+
+        if(Taken()[index].compare_exchange_strong(expected, true))
+          return;
+      }
+
+      printf("fatal: more than %d threads using concurrent trees\n", MAX_THREADS);
+      exit(1);
+    }
+
+    ~ThreadSlot()
+    {
+      Taken()[index].store(false);
+    }
+
+    static std::atomic<bool> * Taken()
+    {
+      static std::atomic<bool> taken[MAX_THREADS];
+
+      return taken;
+    }
+  private:
+    int index;
+};
+
+/* Epoch based reclamation.
+ *
+ * Readers announce the global epoch they started in and clear it when they
+ * are done. The writer can only move the global epoch on once every active
+ * reader has caught up with it. Something unlinked during epoch e can be
+ * reached by readers that started in e or earlier, so it is safe to reuse
+ * once the global epoch reaches e + 2.
+ */
+class EpochManager
+{
+  public:
+    EpochManager()
+      :epoch(1)
+    {
+      for(int i = 0; i < MAX_THREADS; i++)
+        slots[i].active.store(0);
+    }
+
+    uint64_t Current()
+    {
+      return epoch.load();
+    }
+
+    // Reader side. Calls may not nest
+    void Enter()
+    {
+      std::atomic<uint64_t> & active = slots[ThreadSlot::Index()].active;
+      uint64_t current;
+
+      // If the epoch moved on before we were seen, announce the new one
+      do
+      {
+        current = epoch.load();
+        active.store(current);
+      } while(epoch.load() != current);
+    }
+
+    void Exit()
+    {
+      slots[ThreadSlot::Index()].active.store(0, std::memory_order_release);
+    }
+
+    // Writer side. Moves the epoch on if no reader is behind. Returns the
+    // current epoch either way
+    uint64_t TryAdvance()
+    {
+      uint64_t current = epoch.load();
+
+      for(int i = 0; i < MAX_THREADS; i++)
+      {
+        uint64_t active = slots[i].active.load();
+
+        if(active != 0 && active != current)
+          return current;
+      }
+
+      epoch.store(current + 1);
+
+      return current + 1;
+    }
+
+    // Waits until no reader is inside. Only meaningful if readers are kept
+    // from starting new reads in the meantime
+    void WaitForReaders()
+    {
+      for(int i = 0; i < MAX_THREADS; i++)
+      {
+        while(slots[i].active.load() != 0)
+          std::this_thread::yield();
+      }
+    }
+  private:
+    // not copyable
+    EpochManager(const EpochManager &);
+    EpochManager & operator=(const EpochManager &);
+  private:
+    // One cache line per thread so readers don't contend
+    struct alignas(64) Slot
+    {
+      std::atomic<uint64_t> active;
+    };
+
+    alignas(64) std::atomic<uint64_t> epoch;
+    Slot slots[MAX_THREADS];
+};
+
+/* NodePool for trees with concurrent readers. Freed nodes are kept intact
+ * (links and all) until no reader can still be looking at them, and only
+ * then go back on the free list. See EpochManager.
+ */
+template <typename NodeT>
+class RetiringPool : public NodePool<NodeT>
+{
+  public:
+    typedef NodePool<NodeT> Base;
+
+    RetiringPool()
+      :epochs(NULL)
+    {
+    }
+
+    void SetEpochManager(EpochManager * manager)
+    {
+      epochs = manager;
+    }
+
+    NodeRef Allocate(const typename NodeT::key_type & id,
+        const typename NodeT::value_type & count)
+    {
+      NodeRef node = Base::Allocate(id, count);
+
+      // The node (and a new slab) must be visible before the link that
+      // the caller is about to store. Readers follow links with dependent
+      // loads, so this is all they need
+      std::atomic_thread_fence(std::memory_order_release);
+
+      return node;
+    }
+
+    void Free(NodeRef node)
+    {
+      retired.push_back(std::make_pair(node, epochs->Current()));
+    }
+
+    // Hand nodes nobody can be reading any more back to the pool
+    void Reclaim()
+    {
+      if(retired.empty())
+        return;
+
+      uint64_t current = epochs->TryAdvance();
+      size_t done = 0;
+
+      while(done < retired.size() && retired[done].second + 2 <= current)
+        Base::Free(retired[done++].first);
+
+      retired.erase(retired.begin(), retired.begin() + done);
+    }
+
+    void Clear()
+    {
+      retired.clear();
+      Base::Clear();
+    }
+  private:
+    EpochManager * epochs;
+    // Freed nodes and the epoch they were freed in, oldest first
+    std::vector<std::pair<NodeRef, uint64_t> > retired;
+};
+
+}
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef AVLFROZENTREE_H
+#define AVLFROZENTREE_H
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "AVLNode.h"
+
+namespace AVL
+{
+
+/* Read-only copy of a tree for jobs that only query (see BasicTree::Freeze).
+ *
+ * The keys sit in one array in Eytzinger order: the root at index 1 and
+ * the children of index k at 2k and 2k + 1, like a binary heap. A search is
+ * a loop of k = 2k + (keys[k] < id) with no branch on the data, and the top
+ * levels of every search share a few cache lines that stay hot. The nodes
+ * a few levels below k (four for 4-byte keys) are next to each other in
+ * one aligned cache line, so each step prefetches the line it will need
+ * soon. Counts and the sums of the counts before each key are kept in
+ * arrays of their own, so the keys are packed densely.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class BasicFrozenTree
+{
+  public:
+    typedef Key key_type;
+    typedef Value value_type;
+    typedef typename ValueTraits<Value>::sum_type sum_type;
+
+    BasicFrozenTree();
+    // Copies n keys and counts, in increasing key order, from first on
+    template <typename Iterator>
+    BasicFrozenTree(Iterator first, size_t n, const Compare & comp = Compare());
+    ~BasicFrozenTree();
+
+    // Moving hands the arrays over. The source is left empty
+    BasicFrozenTree(BasicFrozenTree && other);
+    BasicFrozenTree & operator=(BasicFrozenTree && other);
+
+    // Number of keys
+    size_t Size() const { return n; }
+    // Bytes held by the arrays
+    size_t Bytes() const { return n ? (n + 1) * (sizeof(Key) + sizeof(Value) + sizeof(sum_type)) : 0; }
+
+    // Same as in BasicTree
+    Value Count(const Key & id) const;
+    bool Next(const Key & id, std::pair<Key, Value> & result) const;
+    bool Previous(const Key & id, std::pair<Key, Value> & result) const;
+    sum_type InRange(const Key & left, const Key & right) const;
+    sum_type Total() const { return total; }
+  private:
+    // not copyable
+    BasicFrozenTree(const BasicFrozenTree &);
+    BasicFrozenTree & operator=(const BasicFrozenTree &);
+
+    // Goes down from the root, right past the keys before id (or equal to
+    // it when inclusive). The result spells the turns taken in binary,
+    // after a leading 1: 0 for left and 1 for right
+    size_t Descend(const Key & id, bool inclusive) const
+    {
+      size_t k = 1;
+
+      while(k <= n)
+      {
+        __builtin_prefetch(keys + PREFETCH_STRIDE * k);
+
+        k = 2 * k + (inclusive ? !comp(id, keys[k]) : comp(keys[k], id));
+      }
+
+      return k;
+    }
+
+    // The node where a descent last went left (the first key after the
+    // ones passed), or right (the last key passed). 0 if it never did
+    static size_t LastLeft(size_t k) { return k >> __builtin_ffsll(~k); }
+    static size_t LastRight(size_t k) { return k >> __builtin_ffsll(k); }
+
+    // The sum of the counts of the keys before node k, where 0 stands for
+    // past the last key
+    sum_type SumBefore(size_t k) const { return k ? below[k] : total; }
+
+    // Fills the subtree at k in key order
+    template <typename Iterator>
+    void Fill(size_t k, Iterator & it, sum_type & running);
+
+    void Release();
+  private:
+    // The descendants log2(stride) levels below k start at stride * k
+    static const size_t PREFETCH_STRIDE = sizeof(Key) < 64 ? 64 / sizeof(Key) : 1;
+
+    // Indexed from 1. Each array starts on a cache line
+    Key * keys;
+    Value * counts;
+    sum_type * below;
+
+    size_t n;
+    sum_type total;
+    Compare comp;
+};
+
+// The frozen version of Tree
+typedef BasicFrozenTree<ID, int> FrozenTree;
+
+#define AVL_FROZEN_TREE_TEMPLATE \
+  template <typename Key, typename Value, typename Compare>
+#define AVL_FROZEN_TREE BasicFrozenTree<Key, Value, Compare>
+
+AVL_FROZEN_TREE_TEMPLATE
+AVL_FROZEN_TREE::BasicFrozenTree()
+  :keys(NULL), counts(NULL), below(NULL), n(0), total(0)
+{
+}
+
+AVL_FROZEN_TREE_TEMPLATE
+template <typename Iterator>
+AVL_FROZEN_TREE::BasicFrozenTree(Iterator first, size_t n, const Compare & comp)
+  :keys(NULL), counts(NULL), below(NULL), n(n), total(0), comp(comp)
+{
+  // The arrays are filled in as raw memory
+  static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+      "frozen trees need plain keys and counts");
+
+  if(n == 0)
+    return;
+
+  keys = static_cast<Key *>(::operator new((n + 1) * sizeof(Key), std::align_val_t(64)));
+  counts = static_cast<Value *>(::operator new((n + 1) * sizeof(Value), std::align_val_t(64)));
+  below = static_cast<sum_type *>(::operator new((n + 1) * sizeof(sum_type), std::align_val_t(64)));
+
+  Fill(1, first, total);
+}
+
+AVL_FROZEN_TREE_TEMPLATE
+AVL_FROZEN_TREE::~BasicFrozenTree()
+{
+  Release();
+}
+
+AVL_FROZEN_TREE_TEMPLATE
+AVL_FROZEN_TREE::BasicFrozenTree(BasicFrozenTree && other)
+  :keys(NULL), counts(NULL), below(NULL), n(0), total(0)
+{
+  *this = std::move(other);
+}
+
+AVL_FROZEN_TREE_TEMPLATE
+AVL_FROZEN_TREE & AVL_FROZEN_TREE::operator=(BasicFrozenTree && other)
+{
+  if(this == &other)
+    return *this;
+
+  Release();
+
+  keys = other.keys;
+  counts = other.counts;
+  below = other.below;
+  n = other.n;
+  total = other.total;
+  comp = other.comp;
+
+  other.keys = NULL;
+  other.counts = NULL;
+  other.below = NULL;
+  other.n = 0;
+  other.total = 0;
+
+  return *this;
+}
+
+AVL_FROZEN_TREE_TEMPLATE
+void AVL_FROZEN_TREE::Release()
+{
+  if(!keys)
+    return;
+
+  ::operator delete(keys, std::align_val_t(64));
+  ::operator delete(counts, std::align_val_t(64));
+  ::operator delete(below, std::align_val_t(64));
+
+  keys = NULL;
+  counts = NULL;
+  below = NULL;
+}
+
+AVL_FROZEN_TREE_TEMPLATE
+template <typename Iterator>
+void AVL_FROZEN_TREE::Fill(size_t k, Iterator & it, sum_type & running)
+{
+  if(k > n)
+    return;
+
+  Fill(2 * k, it, running);
+
+  std::pair<Key, Value> entry = *it;
+  ++it;
+
+  keys[k] = entry.first;
+  counts[k] = entry.second;
+  below[k] = running;
+  running += ValueTraits<Value>::Weight(entry.second);
+
+  Fill(2 * k + 1, it, running);
+}
+
+AVL_FROZEN_TREE_TEMPLATE
+Value AVL_FROZEN_TREE::Count(const Key & id) const
+{
+  size_t k = LastLeft(Descend(id, false));
+
+  // The first key not less than id. A match if it isn't greater either
+  if(!k || comp(id, keys[k]))
+    return Value();
+
+  return counts[k];
+}
+
+AVL_FROZEN_TREE_TEMPLATE
+bool AVL_FROZEN_TREE::Next(const Key & id, std::pair<Key, Value> & result) const
+{
+  size_t k = LastLeft(Descend(id, true));
+
+  if(!k)
+    return false;
+
+  result = std::pair<Key, Value>(keys[k], counts[k]);
+  return true;
+}
+
+AVL_FROZEN_TREE_TEMPLATE
+bool AVL_FROZEN_TREE::Previous(const Key & id, std::pair<Key, Value> & result) const
+{
+  size_t k = LastRight(Descend(id, false));
+
+  if(!k)
+    return false;
+
+  result = std::pair<Key, Value>(keys[k], counts[k]);
+  return true;
+}
+
+AVL_FROZEN_TREE_TEMPLATE
+typename AVL_FROZEN_TREE::sum_type AVL_FROZEN_TREE::InRange(const Key & left, const Key & right) const
+{
+  if(comp(right, left))
+    return 0;
+
+  // Everything before the first key past right, less everything before left
+  return SumBefore(LastLeft(Descend(right, true))) - SumBefore(LastLeft(Descend(left, false)));
+}
+
+#undef AVL_FROZEN_TREE
+#undef AVL_FROZEN_TREE_TEMPLATE
+
+}
+
+#endif
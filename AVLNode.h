@@ -1,52 +1,274 @@
 #ifndef AVLNODE_H
 #define AVLNODE_H
 
+#include <cassert>
+#include <type_traits>
+
 namespace AVL
 {
 
 typedef unsigned int ID;
 
+// Nodes refer to each other by 32-bit index in to the NodePool that owns
+// them rather than by pointer. NO_NODE plays the role of NULL
+typedef unsigned int NodeRef;
+const NodeRef NO_NODE = 0;
+
+// An AVL tree of n nodes is at most 1.44 log2(n) levels deep, so no tree
+// addressable by a 32-bit NodeRef gets anywhere near this
+const int MAX_HEIGHT = 64;
+
+/* How mapped values are aggregated in to the per-subtree sum used by
+ * range queries. The default works for any arithmetic value. Specialize
+ * it for payloads that are not plain numbers.
+ */
+template <typename Value>
+struct ValueTraits
+{
+  typedef long long sum_type;
+
+  static sum_type Weight(const Value & value)
+  {
+    return value;
+  }
+};
+
+/* Access to the node fields that ConcurrentTree readers load while the
+ * writer changes them: links, counts and sums, and the tree's root. The
+ * stores are relaxed atomics, which compile to plain stores but can't be
+ * torn or merged. The single writer can still read its own fields plainly.
+ * Types that aren't scalars are copied as usual, and ConcurrentTree
+ * doesn't take them.
+ */
+template <typename T>
+inline void storeShared(T & field, const T & value)
+{
+  if constexpr(std::is_scalar<T>::value)
+    __atomic_store_n(&field, value, __ATOMIC_RELAXED);
+  else
+    field = value;
+}
+
+// Links are loaded with acquire, which pairs with the release fence in
+// RetiringPool::Allocate so a reader sees a new node fully built
+template <typename T>
+inline T loadShared(const T & field, int order = __ATOMIC_RELAXED)
+{
+  if constexpr(std::is_scalar<T>::value)
+    return __atomic_load_n(&field, order);
+  else
+    return field;
+}
+
+/* A single tree node.
+ *
+ * The layout is kept compact (40 bytes for 32-bit keys and counts) so that
+ * a search touches as few cache lines as possible. Links are NodeRefs and
+ * are resolved through the pool, which is why maintaining the structure
+ * (parents, heights and sums) is the job of the Tree.
+ */
+template <typename Key, typename Value>
 class Node
 {
   public:
-    Node(ID id, int count);
+    typedef Key key_type;
+    typedef Value value_type;
+    typedef typename ValueTraits<Value>::sum_type sum_type;
+
+    Node(const Key & id, const Value & count);
     ~Node();
 
-    // Tree structure
-    // Set the left child and also the left child’s parent to this
-    void setLeft(Node * node);
-    // Set the right child and also the right child’s parent to this
-    void setRight(Node * node);
-    void setParent(Node * node);
-    Node * getLeft();
-    Node * getRight();
-    Node * getParent();
+    // Tree structure. These only change this node's link
+    void setLeft(NodeRef node);
+    void setRight(NodeRef node);
+    void setParent(NodeRef node);
+    NodeRef getLeft();
+    NodeRef getRight();
+    NodeRef getParent();
 
     // Field mutators and getters
-    ID getId();
-    int getCount();
+    const Key & getId();
+    const Value & getCount();
+    // Sum of the counts of every node in this subtree (including this one)
+    sum_type getSum();
+    void setSum(sum_type newSum);
+    // Adds delta to the subtree sum. Used when a descendant's count changes
+    void adjustSum(sum_type delta);
+    // Number of nodes in this subtree (including this one)
+    unsigned int getSize();
+    void setSize(unsigned int newSize);
+    // Adds delta to the subtree size. Used when a descendant is added or removed
+    void adjustSize(int delta);
     // Returns the new count and decreases count by amt
-    int increase(int amt);
+    const Value & increase(const Value & amt);
     // Returns the new count and increases count by amt
-    int decrease(int amt);
+    const Value & decrease(const Value & amt);
+
+    // For readers running alongside the writer (see storeShared)
+    NodeRef loadLeft() { return loadShared(left, __ATOMIC_ACQUIRE); }
+    NodeRef loadRight() { return loadShared(right, __ATOMIC_ACQUIRE); }
+    Value loadCount() { return loadShared(count); }
+    sum_type loadSum() { return loadShared(sum); }
 
     // Tree metadata
+    // Height of this subtree in edges. Kept up to date by the tree
     int getHeight();
-    int getBalance();
-    bool needsRebalance();
-  private:
-    void calculateHeight();
+    void setHeight(int newHeight);
   private:
-    ID id;
-    int count;
+    Key id;
+    Value count;
 
-    // Cached version of the height. Invalidated when structure changed
-    int height;
-    bool heightValid;
+    NodeRef left, right, parent;
+    // Subtree size for order statistics. Like sum it is never lazy. A
+    // tree can't hold more nodes than a NodeRef can address
+    unsigned int size;
 
-    Node *left, *right, *parent;
+    // Height in edges fits easily in a byte (see MAX_HEIGHT). Like size
+    // and sum it is never lazy
+    signed char height;
+
+    // Subtree count sum. Always kept up to date (never lazy) as range
+    // queries rely on it
+    sum_type sum;
 };
 
+template <typename Key, typename Value>
+Node<Key, Value>::Node(const Key & id, const Value & count)
+  :id(id), count(count), left(NO_NODE), right(NO_NODE), parent(NO_NODE),
+   size(1), height(0), sum(ValueTraits<Value>::Weight(count))
+{
+
+}
+
+template <typename Key, typename Value>
+Node<Key, Value>::~Node()
+{
+  left = right = parent = NO_NODE;
+}
+
+template <typename Key, typename Value>
+void Node<Key, Value>::setLeft(NodeRef node)
+{
+  storeShared(left, node);
+}
+
+template <typename Key, typename Value>
+void Node<Key, Value>::setRight(NodeRef node)
+{
+  storeShared(right, node);
+}
+
+template <typename Key, typename Value>
+void Node<Key, Value>::setParent(NodeRef node)
+{
+  parent = node;
+}
+
+template <typename Key, typename Value>
+NodeRef Node<Key, Value>::getLeft()
+{
+  return left;
+}
+
+template <typename Key, typename Value>
+NodeRef Node<Key, Value>::getRight()
+{
+  return right;
+}
+
+template <typename Key, typename Value>
+NodeRef Node<Key, Value>::getParent()
+{
+  return parent;
+}
+
+template <typename Key, typename Value>
+const Key & Node<Key, Value>::getId()
+{
+  return id;
+}
+
+template <typename Key, typename Value>
+const Value & Node<Key, Value>::getCount()
+{
+  return count;
+}
+
+template <typename Key, typename Value>
+typename Node<Key, Value>::sum_type Node<Key, Value>::getSum()
+{
+  return sum;
+}
+
+template <typename Key, typename Value>
+void Node<Key, Value>::setSum(sum_type newSum)
+{
+  storeShared(sum, newSum);
+}
+
+template <typename Key, typename Value>
+void Node<Key, Value>::adjustSum(sum_type delta)
+{
+  storeShared(sum, sum_type(sum + delta));
+}
+
+template <typename Key, typename Value>
+unsigned int Node<Key, Value>::getSize()
+{
+  return size;
+}
+
+template <typename Key, typename Value>
+void Node<Key, Value>::setSize(unsigned int newSize)
+{
+  size = newSize;
+}
+
+template <typename Key, typename Value>
+void Node<Key, Value>::adjustSize(int delta)
+{
+  size += delta;
+}
+
+template <typename Key, typename Value>
+const Value & Node<Key, Value>::increase(const Value & amt)
+{
+  assert(amt > Value());
+
+  storeShared(count, Value(count + amt));
+  storeShared(sum, sum_type(sum + ValueTraits<Value>::Weight(amt)));
+
+  return count;
+}
+
+template <typename Key, typename Value>
+const Value & Node<Key, Value>::decrease(const Value & amt)
+{
+  // make sure we dont decrease a node once it is below or equal
+  // to zero
+  assert(count > Value());
+  assert(amt > Value());
+
+  storeShared(count, Value(count - amt));
+  storeShared(sum, sum_type(sum - ValueTraits<Value>::Weight(amt)));
+
+  return count;
+}
+
+template <typename Key, typename Value>
+int Node<Key, Value>::getHeight()
+{
+  return height;
+}
+
+template <typename Key, typename Value>
+void Node<Key, Value>::setHeight(int newHeight)
+{
+  assert(newHeight >= 0 && newHeight < MAX_HEIGHT);
+
+  height = newHeight;
+}
+
 }
 
 #endif
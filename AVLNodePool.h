@@ -0,0 +1,245 @@
+#ifndef AVLNODEPOOL_H
+#define AVLNODEPOOL_H
+
+#include "AVLNode.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <utility>
+
+namespace AVL
+{
+
+/* Slab allocator and backing array for tree nodes.
+ *
+ * Nodes live in slabs and are addressed by NodeRef. Slab k holds
+ * base * 2^k nodes, so a NodeRef maps to its slab with a single bit scan
+ * and the slab directory is a small fixed array. Freed nodes are recycled
+ * through a free list threaded through their parent links.
+ *
+ * A tree of n nodes costs O(log n) heap allocations (a single one for a
+ * bulk load) and Clear() releases the whole tree without visiting a node.
+ * Node destructors are never run, so keys and values must not own
+ * resources.
+ *
+ * This is the default Allocator of BasicTree. A replacement has to
+ * provide the same members: node_type, Reserve, Allocate, Free, Clear,
+ * Size and Get.
+ */
+template <typename NodeT>
+class NodePool
+{
+  public:
+    typedef NodeT node_type;
+
+    NodePool();
+    ~NodePool();
+
+    // Moving hands the slabs over. The source is left empty
+    NodePool(NodePool && other);
+    NodePool & operator=(NodePool && other);
+
+    // Make room for at least n more nodes. On an empty pool the first slab
+    // is sized to fit all of them, so a bulk load is a single allocation
+    void Reserve(size_t n);
+    NodeRef Allocate(const typename NodeT::key_type & id,
+        const typename NodeT::value_type & count);
+    void Free(NodeRef node);
+    // Release every node at once. Outstanding refs become invalid
+    void Clear();
+
+    // Number of nodes currently handed out
+    size_t Size();
+    // Number of nodes the slabs have room for
+    size_t Capacity();
+
+    NodeT * Get(NodeRef node)
+    {
+      // Slot s lives in slab k where base * (2^k - 1) <= s < base * (2^(k+1) - 1)
+      size_t slot = node - 1;
+      unsigned int slab = Log2((slot >> baseShift) + 1);
+
+      return slabs[slab] + (slot - ((size_t(1) << (slab + baseShift)) - (size_t(1) << baseShift)));
+    }
+  private:
+    // not copyable
+    NodePool(const NodePool &);
+    NodePool & operator=(const NodePool &);
+
+    void AddSlab();
+
+    static unsigned int Log2(size_t v)
+    {
+      return sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(v);
+    }
+  private:
+    static const unsigned int MIN_BASE_SHIFT = 6;
+    static const unsigned int MAX_SLABS = 32;
+
+    NodeT * slabs[MAX_SLABS];
+    unsigned int numSlabs;
+    // log2 of the size of the first slab
+    unsigned int baseShift;
+
+    // slots handed out from the slabs so far and their total size
+    size_t used;
+    size_t capacity;
+
+    size_t liveNodes;
+    NodeRef freeList;
+};
+
+template <typename NodeT>
+NodePool<NodeT>::NodePool()
+  :numSlabs(0), baseShift(MIN_BASE_SHIFT), used(0), capacity(0),
+   liveNodes(0), freeList(NO_NODE)
+{
+
+}
+
+template <typename NodeT>
+NodePool<NodeT>::~NodePool()
+{
+  Clear();
+}
+
+template <typename NodeT>
+NodePool<NodeT>::NodePool(NodePool && other)
+  :numSlabs(0), baseShift(MIN_BASE_SHIFT), used(0), capacity(0),
+   liveNodes(0), freeList(NO_NODE)
+{
+  *this = std::move(other);
+}
+
+template <typename NodeT>
+NodePool<NodeT> & NodePool<NodeT>::operator=(NodePool && other)
+{
+  if(this == &other)
+    return *this;
+
+  Clear();
+
+  for(unsigned int i = 0; i < other.numSlabs; i++)
+    slabs[i] = other.slabs[i];
+
+  numSlabs = other.numSlabs;
+  baseShift = other.baseShift;
+  used = other.used;
+  capacity = other.capacity;
+  liveNodes = other.liveNodes;
+  freeList = other.freeList;
+
+  // the slabs belong to us now
+  other.numSlabs = 0;
+  other.Clear();
+
+  return *this;
+}
+
+template <typename NodeT>
+void NodePool<NodeT>::Reserve(size_t n)
+{
+  // Size the first slab so that it fits the whole request
+  if(numSlabs == 0)
+  {
+    baseShift = MIN_BASE_SHIFT;
+
+    while((size_t(1) << baseShift) < n)
+      baseShift++;
+  }
+
+  while(capacity - used < n)
+    AddSlab();
+}
+
+template <typename NodeT>
+void NodePool<NodeT>::AddSlab()
+{
+  size_t slabNodes = size_t(1) << (numSlabs + baseShift);
+
+  // refs are 32-bit and 0 is reserved
+  if(numSlabs == MAX_SLABS || capacity + slabNodes > 0xffffffffUL)
+  {
+    printf("fatal: node pool exhausted\n");
+    exit(1);
+  }
+
+  slabs[numSlabs++] = static_cast<NodeT *>(::operator new(slabNodes * sizeof(NodeT)));
+  capacity += slabNodes;
+}
+
+template <typename NodeT>
+NodeRef NodePool<NodeT>::Allocate(const typename NodeT::key_type & id,
+    const typename NodeT::value_type & count)
+{
+  NodeRef node;
+
+  if(freeList != NO_NODE)
+  {
+    node = freeList;
+    freeList = Get(node)->getParent();
+  }
+  else
+  {
+    if(used == capacity)
+      AddSlab();
+
+    node = ++used;
+  }
+
+  liveNodes++;
+
+  new (Get(node)) NodeT(id, count);
+
+  return node;
+}
+
+template <typename NodeT>
+void NodePool<NodeT>::Free(NodeRef node)
+{
+  assert(node != NO_NODE);
+  assert(liveNodes > 0);
+
+  // Nodes own no resources so there is nothing to destroy.
+  // Thread the free list through the parent link
+  NodeT * n = Get(node);
+  n->setLeft(NO_NODE);
+  n->setRight(NO_NODE);
+  n->setParent(freeList);
+  freeList = node;
+
+  liveNodes--;
+}
+
+template <typename NodeT>
+void NodePool<NodeT>::Clear()
+{
+  // Nodes own no resources, so the slabs can go without destroying them
+  for(unsigned int i = 0; i < numSlabs; i++)
+    ::operator delete(slabs[i]);
+
+  numSlabs = 0;
+  used = 0;
+  capacity = 0;
+  liveNodes = 0;
+  freeList = NO_NODE;
+}
+
+template <typename NodeT>
+size_t NodePool<NodeT>::Size()
+{
+  return liveNodes;
+}
+
+template <typename NodeT>
+size_t NodePool<NodeT>::Capacity()
+{
+  return capacity;
+}
+
+}
+
+#endif
@@ -0,0 +1,383 @@
+#ifndef AVLSNAPSHOT_H
+#define AVLSNAPSHOT_H
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <string>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace AVL
+{
+
+/* Snapshot file format. All fields are little endian.
+ *
+ *   Header - 40 bytes: 8 byte magic "AVLSNAP\0", u32 version, u32 journal
+ *            generation, u64 number of keys, u64 payload size in bytes,
+ *            u64 checksum of the payload
+ *   Payload - for each key in order, the difference to the previous key
+ *            (the first one to 0) and then its count, each zigzag and
+ *            varint encoded
+ *
+ * Keys in a tree are sorted and usually dense, so most keys and counts
+ * take a byte or two. The checksum catches truncated and corrupted files.
+ * It is not meant to stand up to deliberate tampering.
+ *
+ * The journal generation is the first generation of the journal (see
+ * Journal.h) whose commands are not in the snapshot yet. Version 1 files
+ * had a reserved 0 in its place.
+ */
+const char SNAPSHOT_MAGIC[8] = { 'A', 'V', 'L', 'S', 'N', 'A', 'P', '\0' };
+const uint32_t SNAPSHOT_VERSION = 2;
+const size_t SNAPSHOT_HEADER_SIZE = 40;
+
+// Fast 64-bit checksum, fed 8 bytes at a time. Every Update but the last
+// has to be given a multiple of 8 bytes
+class SnapshotChecksum
+{
+  public:
+    SnapshotChecksum() :hash(0x243f6a8885a308d3ull), length(0) {}
+
+    void Update(const char * data, size_t len)
+    {
+      const unsigned char * p = reinterpret_cast<const unsigned char *>(data);
+      size_t words = len / 8;
+
+      for(size_t i = 0; i < words; i++, p += 8)
+        Mix(GetU64(p));
+
+      // the tail is padded with zeros
+      if(len % 8)
+      {
+        unsigned char tail[8] = { 0 };
+        memcpy(tail, p, len % 8);
+        Mix(GetU64(tail));
+      }
+
+      length += len;
+    }
+
+    uint64_t Value() const
+    {
+      uint64_t h = hash ^ length;
+
+      h ^= h >> 33;
+      h *= 0xff51afd7ed558ccdull;
+      h ^= h >> 33;
+
+      return h;
+    }
+
+    static uint64_t GetU64(const unsigned char * p)
+    {
+      uint64_t v = 0;
+
+      for(int i = 7; i >= 0; i--)
+        v = (v << 8) | p[i];
+
+      return v;
+    }
+
+    static void PutU64(unsigned char * p, uint64_t v)
+    {
+      for(int i = 0; i < 8; i++, v >>= 8)
+        p[i] = v;
+    }
+  private:
+    void Mix(uint64_t word)
+    {
+      hash ^= word;
+      hash = (hash << 29) | (hash >> 35);
+      hash *= 0x9e3779b97f4a7c15ull;
+    }
+  private:
+    uint64_t hash;
+    uint64_t length;
+};
+
+/* Writes a snapshot of keys handed over in order. The file is written
+ * under a temporary name and renamed in place by Finish, so an existing
+ * snapshot is only replaced by a complete one.
+ */
+class SnapshotWriter
+{
+  public:
+    SnapshotWriter() :file(NULL), generation(0), used(0), previous(0), count(0), payload(0) {}
+
+    ~SnapshotWriter()
+    {
+      // Finish wasn't reached. Leave the old snapshot alone
+      if(file)
+      {
+        fclose(file);
+        unlink(temp.c_str());
+      }
+    }
+
+    bool Open(const char * path)
+    {
+      target = path;
+      temp = target + ".tmp";
+      file = fopen(temp.c_str(), "wb");
+
+      if(!file)
+        return false;
+
+      // The header is filled in once the payload is known
+      unsigned char header[SNAPSHOT_HEADER_SIZE] = { 0 };
+
+      return fwrite(header, 1, sizeof(header), file) == sizeof(header);
+    }
+
+    void SetGeneration(uint32_t journal) { generation = journal; }
+
+    void Put(uint64_t key, uint64_t value)
+    {
+      // Leave room for two varints of at most 10 bytes
+      if(used > BUFFER_SIZE - 20)
+        Drain(false);
+
+      PutVarint(Zigzag(key - previous));
+      PutVarint(Zigzag(value));
+
+      previous = key;
+      count++;
+    }
+
+    // Writes the header and moves the file in place. False on any error
+    bool Finish()
+    {
+      Drain(true);
+
+      unsigned char header[SNAPSHOT_HEADER_SIZE] = { 0 };
+
+      memcpy(header, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+      SnapshotChecksum::PutU64(header + 8, SNAPSHOT_VERSION | uint64_t(generation) << 32);
+      SnapshotChecksum::PutU64(header + 16, count);
+      SnapshotChecksum::PutU64(header + 24, payload);
+      SnapshotChecksum::PutU64(header + 32, checksum.Value());
+
+      bool ok = !ferror(file) && fseek(file, 0, SEEK_SET) == 0 &&
+          fwrite(header, 1, sizeof(header), file) == sizeof(header) &&
+          fflush(file) == 0 && fsync(fileno(file)) == 0;
+
+      ok = fclose(file) == 0 && ok;
+      file = NULL;
+
+      if(ok && rename(temp.c_str(), target.c_str()) == 0)
+        return SyncDirectory();
+
+      unlink(temp.c_str());
+      return false;
+    }
+  private:
+    // not copyable
+    SnapshotWriter(const SnapshotWriter &);
+    SnapshotWriter & operator=(const SnapshotWriter &);
+
+    // The rename is only durable once the directory holding the target is
+    // synced. Until then a crash can bring back the old snapshot, which
+    // matters to anything cleared once the new one is saved (the journal)
+    bool SyncDirectory()
+    {
+      size_t slash = target.rfind('/');
+      std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : target.substr(0, slash);
+      int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+
+      if(fd < 0)
+        return false;
+
+      bool ok = fsync(fd) == 0;
+
+      return close(fd) == 0 && ok;
+    }
+
+    static uint64_t Zigzag(uint64_t v)
+    {
+      return (v << 1) ^ (0 - (v >> 63));
+    }
+
+    void PutVarint(uint64_t v)
+    {
+      while(v >= 0x80)
+      {
+        buffer[used++] = char(v | 0x80);
+        v >>= 7;
+      }
+
+      buffer[used++] = char(v);
+    }
+
+    // The checksum takes whole words, so only the last drain may leave a
+    // partial one
+    void Drain(bool last)
+    {
+      size_t len = last ? used : used & ~size_t(7);
+
+      checksum.Update(buffer, len);
+      fwrite(buffer, 1, len, file);
+      payload += len;
+
+      memmove(buffer, buffer + len, used - len);
+      used -= len;
+    }
+  private:
+    static const size_t BUFFER_SIZE = 1 << 16;
+
+    FILE * file;
+    std::string target;
+    std::string temp;
+    uint32_t generation;
+
+    char buffer[BUFFER_SIZE];
+    size_t used;
+
+    uint64_t previous;
+    uint64_t count;
+    uint64_t payload;
+    SnapshotChecksum checksum;
+};
+
+/* Maps a snapshot and hands its keys back in order. Open checks the
+ * header and the checksum before anything is decoded.
+ */
+class SnapshotReader
+{
+  public:
+    SnapshotReader() :data(NULL), size(0), pos(0), end(0), previous(0), count(0), generation(0) {}
+
+    ~SnapshotReader()
+    {
+      if(data)
+        munmap(const_cast<char *>(data), size);
+    }
+
+    // Whether path starts like a snapshot, without checking the rest
+    static bool IsSnapshot(const char * path)
+    {
+      char magic[sizeof(SNAPSHOT_MAGIC)];
+      int fd = open(path, O_RDONLY);
+
+      if(fd < 0)
+        return false;
+
+      bool found = read(fd, magic, sizeof(magic)) == ssize_t(sizeof(magic)) &&
+          memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) == 0;
+
+      close(fd);
+      return found;
+    }
+
+    // False if the file can't be read, isn't a snapshot of this version
+    // or fails its checksum
+    bool Open(const char * path)
+    {
+      int fd = open(path, O_RDONLY);
+      struct stat info;
+
+      if(fd < 0 || fstat(fd, &info) < 0 || size_t(info.st_size) < SNAPSHOT_HEADER_SIZE)
+      {
+        if(fd >= 0)
+          close(fd);
+
+        return false;
+      }
+
+      size = info.st_size;
+      void * mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+
+      if(mapping == MAP_FAILED)
+        return false;
+
+      madvise(mapping, size, MADV_SEQUENTIAL);
+      data = static_cast<const char *>(mapping);
+
+      const unsigned char * header = reinterpret_cast<const unsigned char *>(data);
+      uint64_t payload = SnapshotChecksum::GetU64(header + 24);
+
+      uint64_t version = SnapshotChecksum::GetU64(header + 8);
+
+      count = SnapshotChecksum::GetU64(header + 16);
+      generation = version >> 32;
+
+      // The version is read together with the generation, which version 1
+      // kept at 0. Every key takes at least two bytes
+      if(memcmp(header, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0 ||
+          !(uint32_t(version) == SNAPSHOT_VERSION || version == 1) ||
+          payload != size - SNAPSHOT_HEADER_SIZE || count > payload / 2)
+        return false;
+
+      SnapshotChecksum checksum;
+      checksum.Update(data + SNAPSHOT_HEADER_SIZE, payload);
+
+      if(checksum.Value() != SnapshotChecksum::GetU64(header + 32))
+        return false;
+
+      pos = SNAPSHOT_HEADER_SIZE;
+      end = size;
+
+      return true;
+    }
+
+    uint64_t Count() const { return count; }
+    uint32_t Generation() const { return generation; }
+    // Whether the whole payload has been decoded
+    bool AtEnd() const { return pos == end; }
+
+    // The next key and count. False if the payload ends early
+    bool Next(uint64_t & key, uint64_t & value)
+    {
+      uint64_t delta;
+
+      if(!GetVarint(delta) || !GetVarint(value))
+        return false;
+
+      key = previous += Unzigzag(delta);
+      value = Unzigzag(value);
+
+      return true;
+    }
+  private:
+    // not copyable
+    SnapshotReader(const SnapshotReader &);
+    SnapshotReader & operator=(const SnapshotReader &);
+
+    static uint64_t Unzigzag(uint64_t v)
+    {
+      return (v >> 1) ^ (0 - (v & 1));
+    }
+
+    bool GetVarint(uint64_t & v)
+    {
+      v = 0;
+
+      for(int shift = 0; shift < 64 && pos != end; shift += 7)
+      {
+        unsigned char byte = data[pos++];
+        v |= uint64_t(byte & 0x7f) << shift;
+
+        if(!(byte & 0x80))
+          return true;
+      }
+
+      return false;
+    }
+  private:
+    const char * data;
+    size_t size;
+    size_t pos;
+    size_t end;
+
+    uint64_t previous;
+    uint64_t count;
+    uint32_t generation;
+};
+
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef AVLSTATS_H
+#define AVLSTATS_H
+
+#include <atomic>
+#include <cstddef>
+
+#include "AVLNode.h"
+
+namespace AVL
+{
+
+/* Tree statistics.
+ *
+ * The counters are only kept when built with -DAVL_STATS. Otherwise the
+ * code that updates them is compiled out and they read as 0. The shape of
+ * the tree (nodes, memory, height) is worked out when asked for, so it is
+ * always there.
+ */
+#ifdef AVL_STATS
+#define AVL_STAT(statement) statement
+#else
+#define AVL_STAT(statement)
+#endif
+
+// Named after the rotation, as in the Rebalance debug output
+enum rotation_t { ROTATE_LR, ROTATE_RR, ROTATE_LRR, ROTATE_RLR, NUM_ROTATIONS };
+
+struct TreeStats
+{
+  // Whether the counters below were kept
+  bool counting;
+
+  // Since the tree was created
+  unsigned long long rotations[NUM_ROTATIONS];
+  // Keys added by Increase and removed by Reduce
+  unsigned long long inserts;
+  unsigned long long removes;
+  // Nodes visited on the way back up after those
+  unsigned long long retraced;
+  // Lookups by Increase, Reduce, Count, Next and Previous, by the number
+  // of nodes visited on the way down
+  unsigned long long pathLengths[MAX_HEIGHT + 1];
+  unsigned long long rangeQueries;
+  unsigned long long rangeNodes;
+
+  // Now
+  size_t nodes;
+  // Held by the node pool, and used by the nodes in the tree
+  size_t heapBytes;
+  size_t nodeBytes;
+  // Levels in the tree, and the fewest that could hold its nodes
+  int height;
+  int optimalHeight;
+};
+
+// What the tree updates as it goes. Rebalance can run on several threads
+// at once in BulkIncrease, so the rotations are atomic
+struct StatsCounters
+{
+  StatsCounters()
+    :inserts(0), removes(0), retraced(0), rangeQueries(0), rangeNodes(0)
+  {
+    for(int i = 0; i < NUM_ROTATIONS; i++)
+      rotations[i].store(0);
+
+    for(int i = 0; i <= MAX_HEIGHT; i++)
+      pathLengths[i] = 0;
+  }
+
+  void Rotation(rotation_t type)
+  {
+    rotations[type].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void Search(int visited)
+  {
+    pathLengths[visited < MAX_HEIGHT ? visited : MAX_HEIGHT]++;
+  }
+
+  std::atomic<unsigned long long> rotations[NUM_ROTATIONS];
+  unsigned long long inserts;
+  unsigned long long removes;
+  unsigned long long retraced;
+  unsigned long long pathLengths[MAX_HEIGHT + 1];
+  unsigned long long rangeQueries;
+  unsigned long long rangeNodes;
+};
+
+}
+
+#endif
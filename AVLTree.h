@@ -1,50 +1,2155 @@
 #ifndef AVLTREE_H
 #define AVLTREE_H
 
+#include "AVLFrozenTree.h"
 #include "AVLNode.h"
+#include "AVLNodePool.h"
+#include "AVLSnapshot.h"
+#include "AVLStats.h"
+#include "AVLTreeUtil.h"
+#include "TaskPool.h"
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <queue>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 namespace AVL
 {
 
-class Tree
+/* AVL tree mapping keys to counts.
+ *
+ * Key and Value are stored inline in the nodes, Compare orders the keys
+ * and Allocator provides the node storage (see NodePool). Everything is
+ * resolved at compile time, so comparisons and the subtree sum
+ * aggregation (ValueTraits) inline in to the search and rebalance loops.
+ */
+template <typename Key, typename Value, typename Compare>
+class ConcurrentTree;
+
+template <typename Key, typename Value,
+          typename Compare = std::less<Key>,
+          typename Allocator = NodePool<Node<Key, Value> > >
+class BasicTree
 {
   public:
-    Tree();
-    ~Tree();
+    typedef Key key_type;
+    typedef Value value_type;
+    typedef typename ValueTraits<Value>::sum_type sum_type;
+
+    class const_iterator;
+    // Counts can't be changed through an iterator as that would bypass
+    // the subtree sums
+    typedef const_iterator iterator;
+
+    BasicTree();
+    ~BasicTree();
+
+    // Moving hands the nodes over. The source is left empty
+    BasicTree(BasicTree && other);
+    BasicTree & operator=(BasicTree && other);
 
     // Creation and deletion of the tree
     void Clear();
-    void BuildFromSortedList(std::vector<std::pair<ID, int> > list);
+    void BuildFromSortedList(const std::vector<std::pair<Key, Value> > & list);
+
+    // Snapshots (see AVLSnapshot.h). Keys and counts have to be integers
+    // Writes every key and count to path, along with the journal
+    // generation the tree is up to. Returns false on any error
+    bool SaveSnapshot(const char * path, uint32_t generation = 0);
+    // Replaces the tree with the one saved at path, built in O(n) while
+    // the file is decoded, and fills in the journal generation if asked.
+    // Returns false and leaves the tree empty if path isn't a valid
+    // snapshot
+    bool LoadSnapshot(const char * path, uint32_t * generation = NULL);
+
+    // Copies the tree in to a read-only form (see AVLFrozenTree.h) that
+    // answers Count, Next, Previous and InRange faster. The tree is left
+    // as it was
+    BasicFrozenTree<Key, Value, Compare> Freeze();
+
+    /* Finger search. When enabled, lookups start from the node touched by
+     * the previous operation and climb only as far as needed before they
+     * descend, so a key close to the last one is found in O(log d) steps
+     * for a distance d instead of O(log n). Worth it when keys arrive in
+     * nearly sorted order. Off by default.
+     */
+    void SetFingerSearch(bool enabled) { fingerSearch = enabled; }
 
     // Debugging functions
     bool IsSane();
     void PrintTree();
+    // Counters and the shape of the tree. The counters need AVL_STATS
+    TreeStats Stats();
 
     // Public API for the project
-    void Increase(ID id, int m);
-    void Reduce(ID id, int m);
-    void Next(ID id);
-    void Count(ID id);
-    void Previous(ID id);
-    void InRange(ID left, ID right);
+    // Adds m to the count of id, inserting it if needed. Returns the new
+    // count. Non-positive amounts are ignored and return 0
+    Value Increase(const Key & id, const Value & m);
+    // Takes m from the count of id, removing it once the count drops to
+    // zero or below. Returns the new count, or 0 if it is gone
+    Value Reduce(const Key & id, const Value & m);
+    // Finds the smallest key greater than id. Returns false if there is none
+    bool Next(const Key & id, std::pair<Key, Value> & result);
+    // Returns the count of id, or 0 if it is not in the tree
+    Value Count(const Key & id);
+    // Finds the largest key less than id. Returns false if there is none
+    bool Previous(const Key & id, std::pair<Key, Value> & result);
+    // Returns the sum of the counts of every key in [left, right]
+    sum_type InRange(const Key & left, const Key & right);
+
+    // Order statistics, from the subtree sizes. Ranks start at 1, so
+    // Select(Rank(id)) finds id when it is in the tree
+    // Returns the number of keys less than or equal to id
+    int Rank(const Key & id);
+    // Finds the k-th smallest key. Returns false if k is out of range
+    bool Select(int k, std::pair<Key, Value> & result);
+    // Returns the number of keys in [left, right]
+    int CountDistinct(const Key & left, const Key & right);
+
+    // Number of keys in the tree
+    int Size() { return nodeCount; }
+
+    // Weighted order statistics, from the subtree sums
+    // Returns the sum of every count in the tree
+    sum_type Total() { return Sum(root); }
+    // Finds the smallest key at which the running total of the counts in
+    // key order reaches target. Returns false if the total is less than that
+    bool WeightedSelect(const sum_type & target, std::pair<Key, Value> & result);
+    // The key at which the running total reaches a fraction q (0 to 1) of
+    // the total, e.g. 0.5 for the weighted median. Returns false if q is
+    // out of range or the tree is empty
+    bool Quantile(double q, std::pair<Key, Value> & result);
+
+    // Applies a batch of (id, amount) pairs sorted by id in one pass over
+    // the tree, with the same result as calling Increase on each in turn.
+    // Given a pool, disjoint subtrees are updated in parallel. Returns
+    // false and changes nothing if the batch isn't sorted
+    bool BulkIncrease(const std::vector<std::pair<Key, Value> > & batch, TaskPool * tasks = NULL);
+
+    /* Cutting and splicing. The tree is restructured in O(log n), but
+     * nodes that change trees are copied in to the storage of the tree
+     * they join, so moving k nodes costs another O(k). Split and Join
+     * copy whichever side is shorter.
+     */
+    // Moves every key not less than id in to right, replacing what it held
+    void Split(const Key & id, BasicTree & right);
+    // Appends pivot and every key of right to this tree and empties right.
+    // Every key here must be less than pivotId and every key in right
+    // greater. Returns false and changes nothing if they aren't, or if
+    // pivotCount is not positive
+    bool Join(const Key & pivotId, const Value & pivotCount, BasicTree & right);
+    // Moves the keys in [left, right] in to out, replacing what it held
+    void ExtractRange(const Key & left, const Key & right, BasicTree & out);
+    // Removes every key in [left, right] without rebalancing once per key.
+    // Returns the number of keys removed
+    int EraseRange(const Key & left, const Key & right);
+
+    // In-order iteration. Begin() is the smallest key
+    const_iterator Begin();
+    const_iterator End();
+    // Lower case versions so range-based for works
+    const_iterator begin() { return Begin(); }
+    const_iterator end() { return End(); }
+    // The first key not less than id
+    const_iterator LowerBound(const Key & id);
+    // The first key greater than id
+    const_iterator UpperBound(const Key & id);
+    // Calls visit(id, count) for every key in [left, right] in order
+    template <typename Visitor>
+    void ScanRange(const Key & left, const Key & right, Visitor visit);
+
+    /* Bidirectional in-order iterator. Steps follow the parent links, so a
+     * step is O(1) amortized and nothing is allocated. Changing the count
+     * of an existing key keeps iterators valid, but inserting or removing
+     * a key invalidates all of them.
+     */
+    class const_iterator
+    {
+      public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef void pointer;
+        // Keys and counts are stored separately, so there is no pair to
+        // refer to
+        typedef value_type reference;
+
+        const_iterator() :tree(NULL), node(NO_NODE) {}
+
+        const Key & getId() const { return tree->Get(node)->getId(); }
+        const Value & getCount() const { return tree->Get(node)->getCount(); }
+        value_type operator*() const { return value_type(getId(), getCount()); }
+
+        const_iterator & operator++()
+        {
+          node = tree->Successor(node);
+          return *this;
+        }
+
+        // Stepping back from End() gives the largest key
+        const_iterator & operator--()
+        {
+          node = node ? tree->Predecessor(node) : tree->Last(tree->root);
+          return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+          const_iterator old(*this);
+          ++*this;
+          return old;
+        }
+
+        const_iterator operator--(int)
+        {
+          const_iterator old(*this);
+          --*this;
+          return old;
+        }
+
+        bool operator==(const const_iterator & other) const { return node == other.node; }
+        bool operator!=(const const_iterator & other) const { return node != other.node; }
+      private:
+        friend class BasicTree;
+
+        const_iterator(BasicTree * tree, NodeRef node) :tree(tree), node(node) {}
+
+        BasicTree * tree;
+        // NO_NODE is End()
+        NodeRef node;
+    };
   private:
+    typedef typename Allocator::node_type Node_t;
+
     enum direction_t { LEFT, RIGHT };
-    typedef std::vector<std::pair<Node *, direction_t> > path_t;
+    // The search path lives on the stack. It can't be deeper than the tree
+    typedef FixedVector<std::pair<NodeRef, direction_t>, MAX_HEIGHT> path_t;
 
-    Node * BuildFromSortedListRec(std::vector<std::pair<ID, int> > & list, int l, int r, int depth);
-    int IsBalancedRec(Node * node, bool * result);
-    // Finds the node with ID and returns it. Else NULL.
+    NodeRef BuildFromSortedListRec(const std::vector<std::pair<Key, Value> > & list, int l, int r, int depth);
+    // Builds a balanced subtree out of the next n keys of a snapshot, in
+    // the same shape as BuildFromSortedListRec. last is the node built
+    // before, if any. ok turns false if the keys are bad
+    NodeRef BuildFromSnapshotRec(SnapshotReader & reader, size_t n, NodeRef & last, bool & ok);
+    int IsBalancedRec(NodeRef node, bool * result);
+    // Returns the sum of the counts of all keys less than id, or less than
+    // or equal to it when inclusive
+    sum_type SumBelow(const Key & id, bool inclusive);
+    // Same for the number of keys
+    int CountBelow(const Key & id, bool inclusive);
+    // Finds the node with ID and returns it. Else NO_NODE.
     // Also returns the path used to traverse the tree
-    Node * Find(ID id, path_t & outPath);
+    NodeRef Find(const Key & id, path_t & outPath);
+    // Finds the node with ID without recording the path. Else NO_NODE
+    NodeRef Lookup(const Key & id);
+    // Returns the node to start a search for id from: the root, or with
+    // finger search the lowest node around the finger whose subtree holds
+    // id. Nodes are split at id as in SumBelow. lower and upper are the
+    // closest nodes outside that subtree on either side, if known
+    NodeRef SearchStart(const Key & id, bool inclusive, NodeRef & lower, NodeRef & upper);
+    // Whether node sorts before id (or is equal to it when inclusive)
+    bool Before(NodeRef node, const Key & id, bool inclusive);
+    // Records the path from the root down to node (not including it)
+    void PathTo(NodeRef node, path_t & outPath);
+
+    // Split and join work on detached subtrees (roots without a parent)
+    // Splits the subtree at node in to the nodes before id (see Before) and the rest
+    void SplitNodes(NodeRef node, const Key & id, bool inclusive, NodeRef & lower, NodeRef & upper);
+    // Joins two subtrees and a pivot that sorts between them. Returns the new root
+    NodeRef JoinNodes(NodeRef lower, NodeRef pivot, NodeRef upper);
+    // Joins two subtrees where every key of lower is less than every key of upper
+    NodeRef Concat(NodeRef lower, NodeRef upper);
+    // Takes the smallest node out of the subtree at node. Returns the rest
+    NodeRef RemoveFirst(NodeRef node, NodeRef & first);
+    // Cuts node off from its children and returns them as detached subtrees
+    void Detach(NodeRef node, NodeRef & left, NodeRef & right);
+    // Copies the subtree at node from source in to this tree's storage and
+    // frees the originals. Returns the copy and adds its size to count
+    NodeRef Transfer(BasicTree & source, NodeRef node, int & count);
+
+    // Shared by the recursion of one BulkIncrease
+    struct BulkContext
+    {
+      // The batch with repeats added up and non-positive amounts dropped
+      std::vector<std::pair<Key, Value> > updates;
+      TaskPool * tasks;
+      // New nodes come out of the pool one thread at a time
+      std::mutex allocLock;
+      std::atomic<int> inserted;
+    };
+
+    // Applies updates [lo, hi) to the detached subtree at node. Returns its new root
+    NodeRef BulkIncreaseRec(BulkContext & context, NodeRef node, size_t lo, size_t hi);
+    // Builds a balanced subtree out of updates [lo, hi)
+    NodeRef BulkBuildRec(BulkContext & context, size_t lo, size_t hi);
+
+    // The smallest and largest nodes of the subtree at node
+    NodeRef First(NodeRef node);
+    NodeRef Last(NodeRef node);
+    // The in-order neighbours of node, or NO_NODE at either end
+    NodeRef Successor(NodeRef node);
+    NodeRef Predecessor(NodeRef node);
     // Rebalances the tree starting at node. Returns the new root
-    Node * Rebalance(Node * node);
+    NodeRef Rebalance(NodeRef node);
+    // Walks up path after the subtree below its last node was changed by
+    // an insert or a remove, refreshing heights and rotating where needed.
+    // Stops at the first subtree whose height came out the same, as
+    // nothing above it can have changed. Sums and sizes must already be
+    // right, and the links to the last node's children too
+    void Retrace(path_t & path);
+
+    // The root is read by ConcurrentTree readers too (see storeShared)
+    void SetRoot(NodeRef node) { storeShared(root, node); }
+
+    // Structure helpers. Links are resolved through the pool
+    Node_t * Get(NodeRef node) { return pool.Get(node); }
+    NodeRef Left(NodeRef node) { return Get(node)->getLeft(); }
+    NodeRef Right(NodeRef node) { return Get(node)->getRight(); }
+    NodeRef Parent(NodeRef node) { return Get(node)->getParent(); }
+    sum_type Sum(NodeRef node) { return node ? Get(node)->getSum() : 0; }
+    int Size(NodeRef node) { return node ? Get(node)->getSize() : 0; }
+    // Set the left child and also the left child's parent to node
+    void SetLeft(NodeRef node, NodeRef child);
+    // Set the right child and also the right child's parent to node
+    void SetRight(NodeRef node, NodeRef child);
+    void SetParent(NodeRef node, NodeRef parent);
+    // Refresh the cached metadata of node from its children. Call bottom-up
+    // after the structure below node changed without going through SetLeft/SetRight
+    void Update(NodeRef node);
+    // Refresh only the height
+    void UpdateHeight(NodeRef node);
+    int Height(NodeRef node);
+    int Balance(NodeRef node);
+  private:
+    // not copyable
+    BasicTree(const BasicTree &);
+    BasicTree & operator=(const BasicTree &);
+
+    // Runs its own reads over the nodes (see AVLConcurrentTree.h)
+    template <typename K, typename V, typename C>
+    friend class ConcurrentTree;
   private:
-    Node * root;
+    // Owns the storage of every node in the tree
+    Allocator pool;
+    Compare comp;
+
+    NodeRef root;
     int nodeCount;
+
+    // The node touched by the last operation. Never a freed node
+    NodeRef finger;
+    bool fingerSearch;
+
+#ifdef AVL_STATS
+    StatsCounters counters;
+#endif
 };
 
+// The tree used by bbst
+typedef BasicTree<ID, int> Tree;
+
+#define AVL_TREE_TEMPLATE \
+  template <typename Key, typename Value, typename Compare, typename Allocator>
+#define AVL_TREE BasicTree<Key, Value, Compare, Allocator>
+
+AVL_TREE_TEMPLATE
+AVL_TREE::BasicTree()
+  :root(0), nodeCount(0), finger(NO_NODE), fingerSearch(false)
+{
+
+}
+
+AVL_TREE_TEMPLATE
+AVL_TREE::~BasicTree()
+{
+  Clear();
+}
+
+AVL_TREE_TEMPLATE
+AVL_TREE::BasicTree(BasicTree && other)
+  :pool(std::move(other.pool)), comp(other.comp), root(other.root),
+   nodeCount(other.nodeCount), finger(other.finger),
+   fingerSearch(other.fingerSearch)
+{
+  other.root = NO_NODE;
+  other.nodeCount = 0;
+  other.finger = NO_NODE;
+}
+
+AVL_TREE_TEMPLATE
+AVL_TREE & AVL_TREE::operator=(BasicTree && other)
+{
+  if(this == &other)
+    return *this;
+
+  pool = std::move(other.pool);
+  comp = other.comp;
+  root = other.root;
+  nodeCount = other.nodeCount;
+  finger = other.finger;
+  fingerSearch = other.fingerSearch;
+
+  other.root = NO_NODE;
+  other.nodeCount = 0;
+  other.finger = NO_NODE;
+
+  return *this;
+}
+
+AVL_TREE_TEMPLATE
+void AVL_TREE::Clear()
+{
+  // Drops every node at once instead of walking the tree
+  pool.Clear();
+  SetRoot(NO_NODE);
+  nodeCount = 0;
+  finger = NO_NODE;
+}
+
+AVL_TREE_TEMPLATE
+void AVL_TREE::BuildFromSortedList(const std::vector<std::pair<Key, Value> > & list)
+{
+  Clear();
+
+  // One slab holds the entire tree
+  pool.Reserve(list.size());
+
+  // We want O(n) tree creation from a sorted list.
+  // The algorithm for this is simple: find the middle element of the list
+  // This element becomes the root. This step is performed recursively
+  // on the right and left lists which create the right and left childs
+  SetRoot(BuildFromSortedListRec(list, 0, list.size()-1, 0));
+
+  nodeCount = list.size();
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::BuildFromSortedListRec(const std::vector<std::pair<Key, Value> > & sublist, int l, int r, int depth)
+{
+  // if the list we have is empty or the right bound is less than the left bound,
+  // return no node
+  if(sublist.size() == 0 || r < l)
+    return NO_NODE;
+
+  int middle =  l + (r - l)/2;
+
+  const std::pair<Key, Value> & middleNode = sublist[middle];
+
+  // left - id, right - count
+  NodeRef subroot = pool.Allocate(middleNode.first, middleNode.second);
+
+  //printf("Root %u, l %d, m %d, r %d\n", middleNode.first, l, middle, r);
+
+  SetLeft(subroot, BuildFromSortedListRec(sublist, l, middle-1, depth+1));
+  SetRight(subroot, BuildFromSortedListRec(sublist, middle+1, r, depth+1));
+
+  return subroot;
+}
+
+AVL_TREE_TEMPLATE
+bool AVL_TREE::SaveSnapshot(const char * path, uint32_t generation)
+{
+  static_assert(std::is_integral<Key>::value && std::is_integral<Value>::value,
+      "snapshots need integer keys and counts");
+
+  SnapshotWriter writer;
+
+  if(!writer.Open(path))
+    return false;
+
+  writer.SetGeneration(generation);
+
+  for(NodeRef n = First(root); n != NO_NODE; n = Successor(n))
+    writer.Put(uint64_t(Get(n)->getId()), uint64_t(Get(n)->getCount()));
+
+  return writer.Finish();
+}
+
+AVL_TREE_TEMPLATE
+bool AVL_TREE::LoadSnapshot(const char * path, uint32_t * generation)
+{
+  static_assert(std::is_integral<Key>::value && std::is_integral<Value>::value,
+      "snapshots need integer keys and counts");
+
+  Clear();
+
+  SnapshotReader reader;
+
+  if(!reader.Open(path) || reader.Count() > uint64_t(std::numeric_limits<int>::max()))
+    return false;
+
+  size_t n = reader.Count();
+  NodeRef last = NO_NODE;
+  bool ok = true;
+
+  // The keys are decoded straight in to one slab, without a list in between
+  pool.Reserve(n);
+  SetRoot(BuildFromSnapshotRec(reader, n, last, ok));
+
+  if(!ok || !reader.AtEnd())
+  {
+    Clear();
+    return false;
+  }
+
+  nodeCount = n;
+
+  if(generation)
+    *generation = reader.Generation();
+
+  return true;
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::BuildFromSnapshotRec(SnapshotReader & reader, size_t n, NodeRef & last, bool & ok)
+{
+  if(n == 0 || !ok)
+    return NO_NODE;
+
+  // Same split as BuildFromSortedListRec
+  size_t leftSize = (n - 1) / 2;
+  NodeRef left = BuildFromSnapshotRec(reader, leftSize, last, ok);
+  uint64_t id, count;
+
+  if(!ok || !reader.Next(id, count))
+  {
+    ok = false;
+    return NO_NODE;
+  }
+
+  NodeRef subroot = pool.Allocate(Key(id), Value(count));
+
+  // The keys have to come out strictly increasing with positive counts,
+  // or the tree would be broken
+  if(!(Value(count) > Value()) || (last && !comp(Get(last)->getId(), Key(id))))
+    ok = false;
+
+  last = subroot;
+
+  NodeRef right = BuildFromSnapshotRec(reader, n - 1 - leftSize, last, ok);
+
+  // Link both children before refreshing node once, rather than once per
+  // child as SetLeft and SetRight would
+  Get(subroot)->setLeft(left);
+  Get(subroot)->setRight(right);
+
+  if(left)
+    SetParent(left, subroot);
+  if(right)
+    SetParent(right, subroot);
+
+  Update(subroot);
+
+  return subroot;
+}
+
+AVL_TREE_TEMPLATE
+bool AVL_TREE::IsSane()
+{
+  if(this->root == NO_NODE && nodeCount != 0)
+  {
+    printf("Root is NULL but we should have nodes left!\n");
+    return false;
+  }
+
+  int nodeCountCheck = TreeUtil::GetNumNodes(pool, this->root);
+  if(nodeCountCheck != nodeCount)
+  {
+    printf("Node count FAILED. Got %d, expected %d\n",
+        nodeCountCheck, nodeCount);
+    return false;
+  }
+
+  bool balanced = true;
+
+  // Check if the AVL tree is balanced
+  // returns the height, which we ignore
+  IsBalancedRec(this->root, &balanced);
+
+  // Make sure every node has correct parent pointers
+  // left - node, right expected parent
+  bool parentsOkay = true;
+  bool sumsOkay = true;
+
+  typedef std::pair<NodeRef, NodeRef> item_t;
+  std::queue<item_t> frontier;
+
+  if(this->root)
+    frontier.push(item_t(this->root, NO_NODE));
+
+  while(!frontier.empty())
+  {
+    item_t i = frontier.front();
+    frontier.pop();
+
+    NodeRef n = i.first, expectedParent = i.second;
+    NodeRef parent = Parent(n);
+
+    if(parent != expectedParent)
+    {
+      parentsOkay = false;
+      printf("Parent failure check at node ");
+      TreeUtil::PrintLine(Get(n)->getId());
+      break;
+    }
+
+    // Make sure the subtree sums used by InRange are up to date
+    sum_type expectedSum = ValueTraits<Value>::Weight(Get(n)->getCount());
+
+    if(Left(n))
+      expectedSum += Get(Left(n))->getSum();
+    if(Right(n))
+      expectedSum += Get(Right(n))->getSum();
+
+    if(Get(n)->getSum() != expectedSum)
+    {
+      printf("Sum failure check at node ");
+      TreeUtil::PrintLine(Get(n)->getId());
+      sumsOkay = false;
+      break;
+    }
+
+    if(Size(n) != 1 + Size(Left(n)) + Size(Right(n)))
+    {
+      printf("Size failure check at node ");
+      TreeUtil::PrintLine(Get(n)->getId());
+      sumsOkay = false;
+      break;
+    }
+
+    if(Left(n))
+      frontier.push(item_t(Left(n), n));
+    if(Right(n))
+      frontier.push(item_t(Right(n), n));
+  }
+
+  return balanced && parentsOkay && sumsOkay;
+}
+
+AVL_TREE_TEMPLATE
+int AVL_TREE::IsBalancedRec(NodeRef node, bool * result)
+{
+  if(!node)
+    return -1;
+
+  int leftHeight = IsBalancedRec(Left(node), result);
+  int rightHeight = IsBalancedRec(Right(node), result);
+  int height = std::max(leftHeight, rightHeight) + 1;
+
+  if(abs(leftHeight - rightHeight) > 1) {
+    printf("Tree imbalance at ID ");
+    TreeUtil::PrintLine(Get(node)->getId());
+    *result = false;
+  }
+
+  if(Get(node)->getHeight() != height) {
+    printf("Wrong height at ID ");
+    TreeUtil::PrintLine(Get(node)->getId());
+    *result = false;
+  }
+
+  return height;
+}
+
+AVL_TREE_TEMPLATE
+void AVL_TREE::PrintTree()
+{
+  TreeUtil::PrintTree(pool, root);
+}
+
+AVL_TREE_TEMPLATE
+BasicFrozenTree<Key, Value, Compare> AVL_TREE::Freeze()
+{
+  return BasicFrozenTree<Key, Value, Compare>(Begin(), nodeCount, comp);
+}
+
+AVL_TREE_TEMPLATE
+TreeStats AVL_TREE::Stats()
+{
+  TreeStats stats = TreeStats();
+
+#ifdef AVL_STATS
+  stats.counting = true;
+
+  for(int i = 0; i < NUM_ROTATIONS; i++)
+    stats.rotations[i] = counters.rotations[i].load();
+
+  for(int i = 0; i <= MAX_HEIGHT; i++)
+    stats.pathLengths[i] = counters.pathLengths[i];
+
+  stats.inserts = counters.inserts;
+  stats.removes = counters.removes;
+  stats.retraced = counters.retraced;
+  stats.rangeQueries = counters.rangeQueries;
+  stats.rangeNodes = counters.rangeNodes;
+#endif
+
+  stats.nodes = nodeCount;
+  stats.heapBytes = pool.Capacity() * sizeof(Node_t);
+  stats.nodeBytes = nodeCount * sizeof(Node_t);
+  stats.height = Height(root) + 1;
+
+  // A perfect tree of h levels holds 2^h - 1 nodes
+  while((size_t(1) << stats.optimalHeight) - 1 < size_t(nodeCount))
+    stats.optimalHeight++;
+
+  return stats;
+}
+
+///////////////////////////////////////////////////////////
+// PUBLIC API FOR PROJECT
+///////////////////////////////////////////////////////////
+
+AVL_TREE_TEMPLATE
+Value AVL_TREE::Increase(const Key & id, const Value & m)
+{
+  path_t path;
+
+  // ignore weird counts
+  if(!(m > Value()))
+    return Value();
+
+  NodeRef found = Find(id, path);
+
+  if(found) // found a match
+  {
+    Get(found)->increase(m);
+
+    // every node on the path holds found in its subtree
+    for(int i = path.size()-1; i >= 0; i--)
+      Get(path.at(i).first)->adjustSum(ValueTraits<Value>::Weight(m));
+
+    return Get(found)->getCount();
+  }
+
+  // The only way to reach this point is that a node with
+  // id was not found. We must add a node and possibly rebalance the tree
+  NodeRef newNode = pool.Allocate(id, m);
+
+  // Increase the node count
+  nodeCount++;
+  AVL_STAT(counters.inserts++);
+  finger = newNode;
+
+  // trivial case: first insert
+  if(path.size() == 0)
+  {
+    SetRoot(newNode);
+    return Get(root)->getCount();
+  }
+
+  // Every node on the path gains the new node. Retracing only has to fix
+  // the heights after that
+  for(int i = path.size()-1; i >= 0; i--)
+  {
+    Node_t * n = Get(path.at(i).first);
+
+    n->adjustSum(ValueTraits<Value>::Weight(m));
+    n->adjustSize(1);
+  }
+
+  // insert new node in to tree
+  // If we fell off going left, set the left child to the
+  // new node. Else set right child
+  NodeRef parent = path.at(path.size()-1).first;
+
+  if(path.at(path.size()-1).second == LEFT)
+    Get(parent)->setLeft(newNode);
+  else
+    Get(parent)->setRight(newNode);
+
+  SetParent(newNode, parent);
+  Retrace(path);
+
+  return Get(newNode)->getCount();
+}
+
+AVL_TREE_TEMPLATE
+Value AVL_TREE::Reduce(const Key & id, const Value & m)
+{
+  path_t path;
+
+  // ignore weird counts
+  if(!(m > Value()))
+    return Value();
+
+  NodeRef found = Find(id, path);
+
+  if(!found) // no match
+    return Value();
+
+  sum_type weight = ValueTraits<Value>::Weight(Get(found)->getCount());
+
+  // We found a match. Decrease the count
+  Value newCount = Get(found)->decrease(m);
+
+  // If the new count is above the threshold, then keep the node
+  if(newCount > Value()) {
+    for(int i = path.size()-1; i >= 0; i--)
+      Get(path.at(i).first)->adjustSum(-ValueTraits<Value>::Weight(m));
+
+    return newCount;
+  }
+
+  // adjust the node count
+  nodeCount--;
+  AVL_STAT(counters.removes++);
+
+  // Every node on the path loses found, with everything it held
+  for(int i = path.size()-1; i >= 0; i--)
+  {
+    Node_t * n = Get(path.at(i).first);
+
+    n->adjustSum(-weight);
+    n->adjustSize(-1);
+  }
+
+  // The node has dropped below the count minimum. Remove it, but first find a suitable candidate
+  NodeRef leftChild = Left(found);
+  NodeRef rightChild = Right(found);
+  NodeRef parent = Parent(found);
+  NodeRef replacement;
+  // Where found sits on the path
+  int top = path.size();
+
+  // With at most one child, the child takes found's place
+  if(leftChild == NO_NODE || rightChild == NO_NODE)
+  {
+    replacement = leftChild ? leftChild : rightChild;
+  }
+  // This node has both its children. Its successor, the leftmost node in
+  // the right subtree, takes its place
+  else
+  {
+    /*
+     *         F                S
+     *        / \              / \
+     *       L   R            L   R
+     *          /      ==>       /
+     *         X                X
+     *        /                /
+     *       S                Y
+     *        \
+     *         Y
+     */
+    // The successor goes on the path in found's place, and the nodes down
+    // to its old parent follow. Those lose it from their subtrees
+    NodeRef successor = rightChild;
+
+    path.push_back(std::pair<NodeRef, direction_t>(NO_NODE, RIGHT));
+
+    while(Left(successor))
+    {
+      path.push_back(std::pair<NodeRef, direction_t>(successor, LEFT));
+      successor = Left(successor);
+    }
+
+    Node_t * s = Get(successor);
+    sum_type successorWeight = ValueTraits<Value>::Weight(s->getCount());
+
+    for(int i = top + 1; i < path.size(); i++)
+    {
+      Node_t * n = Get(path.at(i).first);
+
+      n->adjustSum(-successorWeight);
+      n->adjustSize(-1);
+    }
+
+    // Detach the successor, leaving its right child to its parent
+    if(successor != rightChild)
+    {
+      NodeRef successorParent = Parent(successor);
+      NodeRef successorRight = s->getRight();
+
+      Get(successorParent)->setLeft(successorRight);
+
+      if(successorRight)
+        SetParent(successorRight, successorParent);
+
+      s->setRight(rightChild);
+      SetParent(rightChild, successor);
+    }
+
+    s->setLeft(leftChild);
+    SetParent(leftChild, successor);
+
+    // Found's height, so retracing sees what changed below that position
+    Update(successor);
+    s->setHeight(Get(found)->getHeight());
+
+    path.at(top).first = successor;
+    replacement = successor;
+  }
+
+  if(replacement)
+    SetParent(replacement, parent);
+
+  // Change the parent's corresponding child
+  if(!parent)
+    SetRoot(replacement);
+  else if(path.at(top-1).second == LEFT)
+    Get(parent)->setLeft(replacement);
+  else
+    Get(parent)->setRight(replacement);
+
+  Retrace(path);
+
+  // The finger was on found
+  finger = parent ? parent : root;
+
+  pool.Free(found);
+  return Value();
+}
+
+AVL_TREE_TEMPLATE
+bool AVL_TREE::Next(const Key & id, std::pair<Key, Value> & result)
+{
+  NodeRef lower, upper;
+  NodeRef cur = SearchStart(id, true, lower, upper);
+  NodeRef minNode = upper;
+  AVL_STAT(int visited = 0);
+
+  while(cur != NO_NODE)
+  {
+    finger = cur;
+    AVL_STAT(visited++);
+
+    // go left to find a smaller match. Every left turn is smaller
+    // than the previous one, so the last one is the closest
+    if(comp(id, Get(cur)->getId()))
+    {
+      minNode = cur;
+      cur = Left(cur);
+    }
+    // go right to see if something is bigger than id
+    else // id >= cur.id
+    {
+      cur = Right(cur);
+    }
+  }
+
+  AVL_STAT(counters.Search(visited));
+
+  if(!minNode)
+    return false;
+
+  finger = minNode;
+  result = std::pair<Key, Value>(Get(minNode)->getId(), Get(minNode)->getCount());
+  return true;
+}
+
+AVL_TREE_TEMPLATE
+Value AVL_TREE::Count(const Key & id)
+{
+  NodeRef found = Lookup(id);
+
+  if(!found) // no match
+    return Value();
+
+  return Get(found)->getCount();
+}
+
+AVL_TREE_TEMPLATE
+bool AVL_TREE::Previous(const Key & id, std::pair<Key, Value> & result)
+{
+  NodeRef lower, upper;
+  NodeRef cur = SearchStart(id, false, lower, upper);
+  NodeRef maxNode = lower;
+  AVL_STAT(int visited = 0);
+
+  while(cur != NO_NODE)
+  {
+    finger = cur;
+    AVL_STAT(visited++);
+
+    // go right to get something closer. Every right turn is bigger
+    // than the previous one, so the last one is the closest
+    if(comp(Get(cur)->getId(), id))
+    {
+      maxNode = cur;
+      cur = Right(cur);
+    }
+    // go left to get something smaller than id
+    else // id <= cur.id
+    {
+      cur = Left(cur);
+    }
+  }
+
+  AVL_STAT(counters.Search(visited));
+
+  if(!maxNode)
+    return false;
+
+  finger = maxNode;
+  result = std::pair<Key, Value>(Get(maxNode)->getId(), Get(maxNode)->getCount());
+  return true;
+}
+
+AVL_TREE_TEMPLATE
+typename AVL_TREE::sum_type AVL_TREE::InRange(const Key & left, const Key & right)
+{
+  // some bad case 
+  if(comp(right, left))
+    return 0;
+
+  AVL_STAT(counters.rangeQueries++);
+
+  // The range sum is the difference of two prefix sums, each answered
+  // with a single root to leaf descent
+  return SumBelow(right, true) - SumBelow(left, false);
+}
+
+AVL_TREE_TEMPLATE
+typename AVL_TREE::sum_type AVL_TREE::SumBelow(const Key & id, bool inclusive)
+{
+  NodeRef cur = root;
+  sum_type sum = 0;
+
+  while(cur != NO_NODE)
+  {
+    Node_t * n = Get(cur);
+    AVL_STAT(counters.rangeNodes++);
+
+    // everything in the left subtree and this node are below id
+    if(comp(n->getId(), id) || (inclusive && !comp(id, n->getId())))
+    {
+      sum += Sum(n->getLeft()) + ValueTraits<Value>::Weight(n->getCount());
+      cur = n->getRight();
+    }
+    else
+    {
+      cur = n->getLeft();
+    }
+  }
+
+  return sum;
+}
+
+AVL_TREE_TEMPLATE
+int AVL_TREE::Rank(const Key & id)
+{
+  return CountBelow(id, true);
+}
+
+AVL_TREE_TEMPLATE
+bool AVL_TREE::Select(int k, std::pair<Key, Value> & result)
+{
+  if(k < 1 || k > nodeCount)
+    return false;
+
+  NodeRef cur = root;
+
+  while(true)
+  {
+    Node_t * n = Get(cur);
+    int leftSize = Size(n->getLeft());
+
+    if(k <= leftSize)
+    {
+      cur = n->getLeft();
+    }
+    else if(k == leftSize + 1)
+    {
+      finger = cur;
+      result = std::pair<Key, Value>(n->getId(), n->getCount());
+      return true;
+    }
+    else
+    {
+      k -= leftSize + 1;
+      cur = n->getRight();
+    }
+  }
+}
+
+AVL_TREE_TEMPLATE
+int AVL_TREE::CountDistinct(const Key & left, const Key & right)
+{
+  if(comp(right, left))
+    return 0;
+
+  return CountBelow(right, true) - CountBelow(left, false);
+}
+
+AVL_TREE_TEMPLATE
+bool AVL_TREE::WeightedSelect(const sum_type & target, std::pair<Key, Value> & result)
+{
+  if(!root || Sum(root) < target)
+    return false;
+
+  NodeRef cur = root;
+  sum_type remaining = target;
+
+  while(true)
+  {
+    Node_t * n = Get(cur);
+    sum_type leftSum = Sum(n->getLeft());
+    sum_type weight = ValueTraits<Value>::Weight(n->getCount());
+
+    // A target of 0 or less ends up at the smallest key. The check on
+    // the right child keeps a sum that is off by rounding (for floating
+    // point counts) from walking off the tree
+    if(remaining <= leftSum && n->getLeft())
+    {
+      cur = n->getLeft();
+    }
+    else if(remaining <= leftSum + weight || !n->getRight())
+    {
+      finger = cur;
+      result = std::pair<Key, Value>(n->getId(), n->getCount());
+      return true;
+    }
+    else
+    {
+      remaining -= leftSum + weight;
+      cur = n->getRight();
+    }
+  }
+}
+
+AVL_TREE_TEMPLATE
+bool AVL_TREE::Quantile(double q, std::pair<Key, Value> & result)
+{
+  if(!(q >= 0 && q <= 1))
+    return false;
+
+  return WeightedSelect(sum_type(std::ceil(q * Sum(root))), result);
+}
+
+AVL_TREE_TEMPLATE
+int AVL_TREE::CountBelow(const Key & id, bool inclusive)
+{
+  NodeRef cur = root;
+  int count = 0;
+
+  while(cur != NO_NODE)
+  {
+    Node_t * n = Get(cur);
+
+    if(comp(n->getId(), id) || (inclusive && !comp(id, n->getId())))
+    {
+      count += Size(n->getLeft()) + 1;
+      cur = n->getRight();
+    }
+    else
+    {
+      cur = n->getLeft();
+    }
+  }
+
+  return count;
+}
+
+///////////////////////////////////////////////////////////
+// BULK UPDATES
+///////////////////////////////////////////////////////////
+
+AVL_TREE_TEMPLATE
+bool AVL_TREE::BulkIncrease(const std::vector<std::pair<Key, Value> > & batch, TaskPool * tasks)
+{
+  for(size_t i = 1; i < batch.size(); i++)
+  {
+    if(comp(batch[i].first, batch[i-1].first))
+      return false;
+  }
+
+  BulkContext context;
+  context.tasks = tasks;
+  context.inserted = 0;
+
+  // Increase ignores non-positive amounts, and repeats just add up
+  for(size_t i = 0; i < batch.size(); i++)
+  {
+    if(!(batch[i].second > Value()))
+      continue;
+
+    if(!context.updates.empty() && !comp(context.updates.back().first, batch[i].first))
+      context.updates.back().second += batch[i].second;
+    else
+      context.updates.push_back(batch[i]);
+  }
+
+  SetRoot(BulkIncreaseRec(context, root, 0, context.updates.size()));
+  nodeCount += context.inserted;
+
+  return true;
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::BulkIncreaseRec(BulkContext & context, NodeRef node, size_t lo, size_t hi)
+{
+  // Below this many updates a subtree isn't worth handing to another thread
+  const size_t MIN_TASK_UPDATES = 4096;
+
+  if(lo == hi)
+    return node;
+
+  if(!node)
+  {
+    context.inserted += hi - lo;
+    return BulkBuildRec(context, lo, hi);
+  }
+
+  // Updates before node go left, updates after it go right
+  const Key & id = Get(node)->getId();
+  std::pair<Key, Value> * updates = &context.updates[0];
+  size_t mid = std::lower_bound(updates + lo, updates + hi, id,
+      [this](const std::pair<Key, Value> & update, const Key & key) {
+        return comp(update.first, key);
+      }) - updates;
+  size_t upper = mid;
+
+  if(mid < hi && !comp(id, updates[mid].first))
+  {
+    Get(node)->increase(updates[mid].second);
+    upper++;
+  }
+
+  NodeRef left, right;
+  Detach(node, left, right);
+
+  if(context.tasks && hi - lo >= MIN_TASK_UPDATES)
+  {
+    context.tasks->Invoke(
+        [&]() { left = BulkIncreaseRec(context, left, lo, mid); },
+        [&]() { right = BulkIncreaseRec(context, right, upper, hi); });
+  }
+  else
+  {
+    left = BulkIncreaseRec(context, left, lo, mid);
+    right = BulkIncreaseRec(context, right, upper, hi);
+  }
+
+  // New keys may have made one side much taller. Joining rebalances
+  return JoinNodes(left, node, right);
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::BulkBuildRec(BulkContext & context, size_t lo, size_t hi)
+{
+  if(lo == hi)
+    return NO_NODE;
+
+  size_t middle = lo + (hi - lo)/2;
+  const std::pair<Key, Value> & update = context.updates[middle];
+  NodeRef subroot;
+
+  {
+    std::lock_guard<std::mutex> lock(context.allocLock);
+    subroot = pool.Allocate(update.first, update.second);
+  }
+
+  SetLeft(subroot, BulkBuildRec(context, lo, middle));
+  SetRight(subroot, BulkBuildRec(context, middle + 1, hi));
+
+  return subroot;
+}
+
+///////////////////////////////////////////////////////////
+// SPLIT AND JOIN
+///////////////////////////////////////////////////////////
+
+AVL_TREE_TEMPLATE
+void AVL_TREE::Split(const Key & id, BasicTree & right)
+{
+  if(&right == this)
+    return;
+
+  right.Clear();
+
+  NodeRef lower, upper;
+  SplitNodes(root, id, false, lower, upper);
+
+  int moved = 0;
+
+  // Keep the taller half where it is and copy the other one over
+  if(Height(lower) < Height(upper))
+  {
+    std::swap(pool, right.pool);
+
+    right.SetRoot(upper);
+    SetRoot(Transfer(right, lower, moved));
+
+    right.nodeCount = nodeCount - moved;
+    nodeCount = moved;
+  }
+  else
+  {
+    SetRoot(lower);
+    right.SetRoot(right.Transfer(*this, upper, moved));
+
+    right.nodeCount = moved;
+    nodeCount -= moved;
+  }
+
+  finger = right.finger = NO_NODE;
+}
+
+AVL_TREE_TEMPLATE
+bool AVL_TREE::Join(const Key & pivotId, const Value & pivotCount, BasicTree & right)
+{
+  if(&right == this || !(pivotCount > Value()))
+    return false;
+
+  if(root && !comp(Get(Last(root))->getId(), pivotId))
+    return false;
+
+  if(right.root && !comp(pivotId, right.Get(right.First(right.root))->getId()))
+    return false;
+
+  NodeRef lower, upper;
+  int moved = 0;
+
+  // Keep the taller tree where it is and copy the other one over
+  if(Height(root) >= right.Height(right.root))
+  {
+    lower = root;
+    upper = Transfer(right, right.root, moved);
+  }
+  else
+  {
+    std::swap(pool, right.pool);
+
+    upper = right.root;
+    lower = Transfer(right, root, moved);
+  }
+
+  nodeCount += right.nodeCount + 1;
+  SetRoot(JoinNodes(lower, pool.Allocate(pivotId, pivotCount), upper));
+  finger = NO_NODE;
+
+  right.Clear();
+
+  return true;
+}
+
+AVL_TREE_TEMPLATE
+void AVL_TREE::ExtractRange(const Key & left, const Key & right, BasicTree & out)
+{
+  if(&out == this)
+    return;
+
+  out.Clear();
+
+  if(comp(right, left))
+    return;
+
+  NodeRef lower, rest, middle, upper;
+  SplitNodes(root, left, false, lower, rest);
+  SplitNodes(rest, right, true, middle, upper);
+
+  SetRoot(Concat(lower, upper));
+
+  int moved = 0;
+  out.SetRoot(out.Transfer(*this, middle, moved));
+
+  out.nodeCount = moved;
+  nodeCount -= moved;
+  finger = NO_NODE;
+}
+
+AVL_TREE_TEMPLATE
+int AVL_TREE::EraseRange(const Key & left, const Key & right)
+{
+  if(comp(right, left))
+    return 0;
+
+  NodeRef lower, rest, middle, upper;
+  SplitNodes(root, left, false, lower, rest);
+  SplitNodes(rest, right, true, middle, upper);
+
+  SetRoot(Concat(lower, upper));
+
+  int removed = TreeUtil::FreeAll(pool, middle);
+
+  nodeCount -= removed;
+  finger = NO_NODE;
+
+  return removed;
+}
+
+AVL_TREE_TEMPLATE
+void AVL_TREE::SplitNodes(NodeRef node, const Key & id, bool inclusive, NodeRef & lower, NodeRef & upper)
+{
+  if(!node)
+  {
+    lower = upper = NO_NODE;
+    return;
+  }
+
+  NodeRef left, right;
+  Detach(node, left, right);
+
+  // node and one of its subtrees end up on the same side. Split the
+  // other subtree and join its near half back on with node as the pivot
+  if(Before(node, id, inclusive))
+  {
+    NodeRef rightLower;
+
+    SplitNodes(right, id, inclusive, rightLower, upper);
+    lower = JoinNodes(left, node, rightLower);
+  }
+  else
+  {
+    NodeRef leftUpper;
+
+    SplitNodes(left, id, inclusive, lower, leftUpper);
+    upper = JoinNodes(leftUpper, node, right);
+  }
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::JoinNodes(NodeRef lower, NodeRef pivot, NodeRef upper)
+{
+  int lowerHeight = Height(lower);
+  int upperHeight = Height(upper);
+
+  // Close enough in height for the pivot to become the root
+  if(abs(lowerHeight - upperHeight) <= 1)
+  {
+    SetLeft(pivot, lower);
+    SetRight(pivot, upper);
+    SetParent(pivot, NO_NODE);
+
+    return pivot;
+  }
+
+  NodeRef cur;
+
+  if(lowerHeight > upperHeight)
+  {
+    // Go down the right side of lower to a subtree about as tall as upper
+    // and hang the pivot with upper there
+    cur = lower;
+
+    while(Height(Right(cur)) > upperHeight + 1)
+      cur = Right(cur);
+
+    SetLeft(pivot, Right(cur));
+    SetRight(pivot, upper);
+    SetRight(cur, pivot);
+  }
+  else
+  {
+    cur = upper;
+
+    while(Height(Left(cur)) > lowerHeight + 1)
+      cur = Left(cur);
+
+    SetRight(pivot, Left(cur));
+    SetLeft(pivot, lower);
+    SetLeft(cur, pivot);
+  }
+
+  // Rebalance back up to the root
+  while(true)
+  {
+    NodeRef parent = Parent(cur);
+    bool isLeft = parent && Left(parent) == cur;
+    NodeRef newRoot = Rebalance(cur);
+
+    if(!parent)
+      return newRoot;
+
+    if(isLeft)
+      SetLeft(parent, newRoot);
+    else
+      SetRight(parent, newRoot);
+
+    cur = parent;
+  }
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::Concat(NodeRef lower, NodeRef upper)
+{
+  if(!lower)
+    return upper;
+
+  if(!upper)
+    return lower;
+
+  NodeRef first;
+  NodeRef rest = RemoveFirst(upper, first);
+
+  return JoinNodes(lower, first, rest);
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::RemoveFirst(NodeRef node, NodeRef & first)
+{
+  NodeRef left, right;
+  Detach(node, left, right);
+
+  if(!left)
+  {
+    first = node;
+    return right;
+  }
+
+  NodeRef rest = RemoveFirst(left, first);
+
+  return JoinNodes(rest, node, right);
+}
+
+AVL_TREE_TEMPLATE
+void AVL_TREE::Detach(NodeRef node, NodeRef & left, NodeRef & right)
+{
+  left = Left(node);
+  right = Right(node);
+
+  if(left)
+    SetParent(left, NO_NODE);
+  if(right)
+    SetParent(right, NO_NODE);
+
+  Get(node)->setLeft(NO_NODE);
+  Get(node)->setRight(NO_NODE);
+  Update(node);
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::Transfer(BasicTree & source, NodeRef node, int & count)
+{
+  if(!node)
+    return NO_NODE;
+
+  Node_t * n = source.Get(node);
+  NodeRef copy = pool.Allocate(n->getId(), n->getCount());
+
+  SetLeft(copy, Transfer(source, n->getLeft(), count));
+  SetRight(copy, Transfer(source, n->getRight(), count));
+
+  source.pool.Free(node);
+  count++;
+
+  return copy;
+}
+
+///////////////////////////////////////////////////////////
+// ITERATION
+///////////////////////////////////////////////////////////
+
+AVL_TREE_TEMPLATE
+typename AVL_TREE::const_iterator AVL_TREE::Begin()
+{
+  return const_iterator(this, First(root));
+}
+
+AVL_TREE_TEMPLATE
+typename AVL_TREE::const_iterator AVL_TREE::End()
+{
+  return const_iterator(this, NO_NODE);
+}
+
+AVL_TREE_TEMPLATE
+typename AVL_TREE::const_iterator AVL_TREE::LowerBound(const Key & id)
+{
+  NodeRef cur = root;
+  NodeRef bound = NO_NODE;
+
+  while(cur != NO_NODE)
+  {
+    // cur >= id. Anything closer is to the left
+    if(!comp(Get(cur)->getId(), id))
+    {
+      bound = cur;
+      cur = Left(cur);
+    }
+    else
+    {
+      cur = Right(cur);
+    }
+  }
+
+  return const_iterator(this, bound);
+}
+
+AVL_TREE_TEMPLATE
+typename AVL_TREE::const_iterator AVL_TREE::UpperBound(const Key & id)
+{
+  NodeRef cur = root;
+  NodeRef bound = NO_NODE;
+
+  while(cur != NO_NODE)
+  {
+    // cur > id. Anything closer is to the left
+    if(comp(id, Get(cur)->getId()))
+    {
+      bound = cur;
+      cur = Left(cur);
+    }
+    else
+    {
+      cur = Right(cur);
+    }
+  }
+
+  return const_iterator(this, bound);
+}
+
+AVL_TREE_TEMPLATE
+template <typename Visitor>
+void AVL_TREE::ScanRange(const Key & left, const Key & right, Visitor visit)
+{
+  if(comp(right, left))
+    return;
+
+  for(NodeRef cur = LowerBound(left).node; cur != NO_NODE; cur = Successor(cur))
+  {
+    Node_t * n = Get(cur);
+
+    if(comp(right, n->getId()))
+      break;
+
+    visit(n->getId(), n->getCount());
+  }
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::First(NodeRef node)
+{
+  if(!node)
+    return NO_NODE;
+
+  while(Left(node))
+    node = Left(node);
+
+  return node;
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::Last(NodeRef node)
+{
+  if(!node)
+    return NO_NODE;
+
+  while(Right(node))
+    node = Right(node);
+
+  return node;
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::Successor(NodeRef node)
+{
+  if(Right(node))
+    return First(Right(node));
+
+  // Climb until we come up from a left child
+  NodeRef parent = Parent(node);
+
+  while(parent && Right(parent) == node)
+  {
+    node = parent;
+    parent = Parent(node);
+  }
+
+  return parent;
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::Predecessor(NodeRef node)
+{
+  if(Left(node))
+    return Last(Left(node));
+
+  // Climb until we come up from a right child
+  NodeRef parent = Parent(node);
+
+  while(parent && Left(parent) == node)
+  {
+    node = parent;
+    parent = Parent(node);
+  }
+
+  return parent;
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::Find(const Key & id, path_t & outPath)
+{
+  NodeRef lower, upper;
+  NodeRef cur = SearchStart(id, false, lower, upper);
+
+  // The climb may have stopped right at id
+  if(upper && !comp(id, Get(upper)->getId()))
+    cur = upper;
+
+  // Which node and which direction did we choose on that node
+  outPath.clear();
+
+  // A finger search starts part way down. The callers still need the
+  // path from the root
+  if(cur != root)
+    PathTo(cur, outPath);
+
+  AVL_STAT(int visited = 0);
+
+  while(cur != NO_NODE)
+  {
+    finger = cur;
+    AVL_STAT(visited++);
+
+    if(comp(Get(cur)->getId(), id)) // go right
+    {
+      outPath.push_back(std::pair<NodeRef, direction_t>(cur, RIGHT));
+      cur = Right(cur);
+    }
+    else if(comp(id, Get(cur)->getId())) // go left
+    {
+      outPath.push_back(std::pair<NodeRef, direction_t>(cur, LEFT));
+      cur = Left(cur);
+    }
+    else // found a match
+    {
+      break;
+    }
+  }
+
+  AVL_STAT(counters.Search(visited));
+
+  // NO_NODE if we fell off the tree
+  return cur;
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::Lookup(const Key & id)
+{
+  NodeRef lower, upper;
+  NodeRef cur = SearchStart(id, false, lower, upper);
+
+  if(upper && !comp(id, Get(upper)->getId()))
+    cur = upper;
+
+  AVL_STAT(int visited = 0);
+
+  while(cur != NO_NODE)
+  {
+    finger = cur;
+    AVL_STAT(visited++);
+
+    if(comp(Get(cur)->getId(), id))
+      cur = Right(cur);
+    else if(comp(id, Get(cur)->getId()))
+      cur = Left(cur);
+    else
+      break;
+  }
+
+  AVL_STAT(counters.Search(visited));
+
+  return cur;
+}
+
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::SearchStart(const Key & id, bool inclusive, NodeRef & lower, NodeRef & upper)
+{
+  lower = upper = NO_NODE;
+
+  if(!fingerSearch || !finger)
+    return root;
+
+  NodeRef cur = finger;
+
+  while(true)
+  {
+    // Which side of cur the search position is on
+    bool right = Before(cur, id, inclusive);
+
+    // Ancestors on the far side of that are no use as a bound. Climb past
+    // them to the first one on the same side
+    NodeRef child = cur;
+    NodeRef parent = Parent(cur);
+
+    while(parent && (Right(parent) == child) == right)
+    {
+      child = parent;
+      parent = Parent(parent);
+    }
+
+    // No bound. The search position could be anywhere
+    if(!parent)
+      return root;
+
+    // parent bounds the subtree of cur. If it is beyond the search position
+    // then that is inside cur's subtree
+    if(Before(parent, id, inclusive) != right)
+    {
+      if(right)
+        upper = parent;
+      else
+        lower = parent;
+
+      return cur;
+    }
+
+    cur = parent;
+  }
+}
+
+AVL_TREE_TEMPLATE
+bool AVL_TREE::Before(NodeRef node, const Key & id, bool inclusive)
+{
+  const Key & nodeId = Get(node)->getId();
+
+  return comp(nodeId, id) || (inclusive && !comp(id, nodeId));
+}
+
+AVL_TREE_TEMPLATE
+void AVL_TREE::PathTo(NodeRef node, path_t & outPath)
+{
+  int start = outPath.size();
+
+  for(NodeRef parent = Parent(node); parent; node = parent, parent = Parent(parent))
+    outPath.push_back(std::pair<NodeRef, direction_t>(parent, Left(parent) == node ? LEFT : RIGHT));
+
+  // We went bottom-up, the path is top-down
+  for(int i = start, j = outPath.size()-1; i < j; i++, j--)
+    std::swap(outPath.at(i), outPath.at(j));
+}
+
+/** Rebalance the tree starting at node
+ *
+ *  This can return a new rearrainged tree, if a balance was made.
+ *  In this case, the new tree has no parent and it must be set.
+ *
+ *  @returns New root node with no parent or NULL
+ */
+AVL_TREE_TEMPLATE
+NodeRef AVL_TREE::Rebalance(NodeRef node)
+{
+  /* Steps to decide on rebalancing
+   *
+   * 1. Check starting node balance, if needs rebalance continue to 2, else
+   *    process parent, if any. If no parent, stop
+   * 2. Determine rebalance type
+   * 3. Perform appropriate rotation:
+   *
+   *   * Left (LR)
+   *
+   *         A         <--.          B
+   *        / \            \        / \
+   *       X   B            "      /   \
+   *          / \       B   |     A     C
+   *         Y   C         /     / \   / \
+   *            / \   '---'     X   Y 0   0
+   *           0   0
+   *
+   *   * Right (RR)
+   *
+   *         A         .-->          B
+   *        / \       /             / \
+   *       B   X     "             /   \
+   *      / \        |  B         C     A
+   *     C   Y       \           / \   / \
+   *    / \           '---'     0   0 Y   X
+   *   0   0
+   *
+   *   * Left-Right (LRR)
+   *
+   *         A         <--.          A       .-->         C
+   *        / \            \        / \     /            / \
+   *       B   X            "      C   X   "            /   \
+   *      / \           B   |     / \      |  C        B     A
+   *     Y   C             /     B   I     \          / \   / \
+   *        / \       '---'     / \         '---'    Y   J I   X
+   *       J   I               Y   J
+   *
+   *   * Right-Left (RLR)
+   *
+   *         A          .-->     A           <--.          C
+   *        / \        /        / \              \        / \
+   *       X   B      "        X   C              "      /   \
+   *          / \     |  B        / \         C   |     A     B
+   *         C   Y    \          I   B           /     / \   / \
+   *        / \        '---'        / \     '---'     X   I J   Y
+   *       I   J                   J   Y
+   */
+
+  // empty tree, no parent
+  if(!node)
+    return NO_NODE;
+
+  int balance = Balance(node);
+
+#ifdef DEBUG
+  printf("Rebalance: balance %d\n", balance);
+#endif
+
+  // leaf node
+  if(Left(node) == NO_NODE && Right(node) == NO_NODE)
+    return node;
+
+  // Tree is right heavy
+  if(balance == -2)
+  {
+    NodeRef A = node;
+    NodeRef B = Right(node);
+
+    // Left rotate (LR). A balanced B (only after a removal) needs a single
+    // rotation too. A double one could leave B unbalanced
+    if(Balance(B) <= 0)
+    {
+#ifdef DEBUG
+      printf("Rebalance: LR\n");
+#endif
+      AVL_STAT(counters.Rotation(ROTATE_LR));
+
+      NodeRef C = Right(B);
+      NodeRef Y = Left(B);
+
+      SetRight(A, Y);
+      SetLeft(B, A);
+      SetRight(B, C);
+      SetParent(B, NO_NODE);
+
+      return B;
+    }
+    // Right-Left rotation (RLR)
+    else
+    {
+#ifdef DEBUG
+      printf("Rebalance: RLR\n");
+#endif
+      AVL_STAT(counters.Rotation(ROTATE_RLR));
+
+      NodeRef C = Left(B);
+      NodeRef I = Left(C);
+      NodeRef J = Right(C);
+
+      SetRight(A, I);
+      SetLeft(B, J);
+      SetLeft(C, A);
+      SetRight(C, B);
+      SetParent(C, NO_NODE);
+
+      return C;
+    }
+  }
+  // Tree is left heavy
+  else if(balance == 2)
+  {
+    NodeRef A = node;
+    NodeRef B = Left(node);
+
+    // Right rotate (RR)
+    if(Balance(B) >= 0)
+    {
+#ifdef DEBUG
+      printf("Rebalance: RR\n");
+#endif
+      AVL_STAT(counters.Rotation(ROTATE_RR));
+
+      NodeRef C = Left(B);
+      NodeRef Y = Right(B);
+
+      SetLeft(A, Y);
+      SetRight(B, A);
+      SetLeft(B, C);
+      SetParent(B, NO_NODE);
+
+      return B;
+    }
+    // Left-Right rotation (LRR)
+    else
+    {
+#ifdef DEBUG
+      printf("Rebalance: LRR pivot ");
+      TreeUtil::PrintLine(Get(A)->getId());
+#endif
+      AVL_STAT(counters.Rotation(ROTATE_LRR));
+
+      NodeRef C = Right(B);
+      NodeRef J = Left(C);
+      NodeRef I = Right(C);
+
+      SetRight(B, J);
+      SetLeft(A, I);
+      SetLeft(C, B);
+      SetRight(C, A);
+      SetParent(C, NO_NODE);
+
+      return C;
+    }
+  }
+  // Tree is balanced
+  else
+  {
+    return node;
+  }
+}
+
+AVL_TREE_TEMPLATE
+void AVL_TREE::Retrace(path_t & path)
+{
+  for(int i = path.size()-1; i >= 0; i--)
+  {
+    NodeRef cur = path.at(i).first;
+    int oldHeight = Get(cur)->getHeight();
+    int balance = Balance(cur);
+    NodeRef newRoot = cur;
+
+    AVL_STAT(counters.retraced++);
+
+#ifdef DEBUG
+    printf("Retrace ");
+    TreeUtil::PrintLine(Get(cur)->getId(), balance);
+#endif
+
+    if(balance > 1 || balance < -1)
+    {
+      newRoot = Rebalance(cur);
+
+      // Put the rotated subtree back without touching the parent's
+      // height, which the next step compares
+      if(i == 0)
+      {
+        SetRoot(newRoot);
+      }
+      else
+      {
+        NodeRef parent = path.at(i-1).first;
+
+        if(path.at(i-1).second == LEFT)
+          Get(parent)->setLeft(newRoot);
+        else
+          Get(parent)->setRight(newRoot);
+
+        SetParent(newRoot, parent);
+      }
+    }
+    else
+    {
+      UpdateHeight(cur);
+    }
+
+    if(Get(newRoot)->getHeight() == oldHeight)
+      return;
+  }
+}
+
+///////////////////////////////////////////////////////////
+// STRUCTURE HELPERS
+///////////////////////////////////////////////////////////
+
+AVL_TREE_TEMPLATE
+void AVL_TREE::SetLeft(NodeRef node, NodeRef child)
+{
+  Get(node)->setLeft(child);
+
+  if(child)
+    SetParent(child, node);
+
+  Update(node);
+}
+
+AVL_TREE_TEMPLATE
+void AVL_TREE::SetRight(NodeRef node, NodeRef child)
+{
+  Get(node)->setRight(child);
+
+  if(child)
+    SetParent(child, node);
+
+  Update(node);
+}
+
+AVL_TREE_TEMPLATE
+void AVL_TREE::SetParent(NodeRef node, NodeRef parent)
+{
+  Get(node)->setParent(parent);
+
+  // adding a parent doesnt change the height of this node
+}
+
+AVL_TREE_TEMPLATE
+void AVL_TREE::Update(NodeRef node)
+{
+  Node_t * n = Get(node);
+
+  n->setHeight(std::max(Height(n->getLeft()), Height(n->getRight())) + 1);
+  n->setSum(ValueTraits<Value>::Weight(n->getCount()) +
+      Sum(n->getLeft()) + Sum(n->getRight()));
+  n->setSize(1 + Size(n->getLeft()) + Size(n->getRight()));
+}
+
+AVL_TREE_TEMPLATE
+void AVL_TREE::UpdateHeight(NodeRef node)
+{
+  Node_t * n = Get(node);
+
+  n->setHeight(std::max(Height(n->getLeft()), Height(n->getRight())) + 1);
+}
+
+/* Calculates the height and balance of the current node.
+ * A height of -1 means no height (no node).
+ * Height is measured in the number of edges, not nodes.
+ *
+ * Case 1 - No children
+ *   - leftH = -1
+ *   - rightH = -1
+ *   - height = max(l, r) + 1 = 0
+ *   - balance = leftH - rightH = 0
+ *
+ * Case 2 - Left child only
+ *   - leftH = 0
+ *   - rightH = -1
+ *   - height = max(l, r) + 1 = 1
+ *   - balance = leftH - rightH = 1
+ *
+ * Case 3 - Right child only
+ *   - leftH = -1
+ *   - rightH = 0 
+ *   - height = max(l, r) + 1 = 1
+ *   - balance = leftH - rightH = -1
+ *
+ * Case 4 - Both children
+ *   - leftH = 0 
+ *   - rightH = 0 
+ *   - height = max(l, r) + 1 = 1
+ *   - balance = leftH - rightH = 0
+ *
+ * Case 5 - Imbalanced left tree
+ *   - leftH = 2 
+ *   - rightH = 0 
+ *   - height = max(l, r) + 1 = 3
+ *   - balance = leftH - rightH = 2
+ *
+ * Case 6 - Imbalanced right tree
+ *   - leftH = -1 
+ *   - rightH = 1 
+ *   - height = max(l, r) + 1 = 2
+ *   - balance = leftH - rightH = -2
+ *
+ */
+
+AVL_TREE_TEMPLATE
+int AVL_TREE::Height(NodeRef node)
+{
+  return node ? Get(node)->getHeight() : -1;
+}
+
+AVL_TREE_TEMPLATE
+int AVL_TREE::Balance(NodeRef node)
+{
+  return Height(Left(node)) - Height(Right(node));
+}
+
+#undef AVL_TREE
+#undef AVL_TREE_TEMPLATE
+
 }
 
 #endif
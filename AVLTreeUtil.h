@@ -4,6 +4,12 @@
 #include "AVLNode.h"
 
 #include <vector>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
 
 namespace AVL
 {
@@ -11,15 +17,212 @@ namespace AVL
 class TreeUtil
 {
 public:
-  static void PrintTree(Node * root);
-  static int GetNodeHeight(Node * node);
-  static int GetNumNodes(Node * node);
-  static void FreeAll(Node * node);
+  template <typename Pool>
+  static void PrintTree(Pool & pool, NodeRef root);
+  template <typename Pool>
+  static int GetNodeHeight(Pool & pool, NodeRef node);
+  template <typename Pool>
+  static int GetNumNodes(Pool & pool, NodeRef node);
+  // Frees the subtree at node. Returns the number of nodes freed
+  template <typename Pool>
+  static int FreeAll(Pool & pool, NodeRef node);
+
+  // Print keys and values with printf when they are plain numbers.
+  // Anything else goes through its operator<<
+  static void Print(int value) { printf("%d", value); }
+  static void Print(unsigned int value) { printf("%u", value); }
+  static void Print(long value) { printf("%ld", value); }
+  static void Print(unsigned long value) { printf("%lu", value); }
+  static void Print(long long value) { printf("%lld", value); }
+  static void Print(unsigned long long value) { printf("%llu", value); }
+  template <typename T>
+  static void Print(const T & value) { std::cout << value; }
+
+  template <typename A>
+  static void PrintLine(const A & a)
+  {
+    Print(a);
+    putchar('\n');
+  }
+
+  template <typename A, typename B>
+  static void PrintLine(const A & a, const B & b)
+  {
+    Print(a);
+    putchar(' ');
+    Print(b);
+    putchar('\n');
+  }
 private:
-  static void PrintTreeRec(std::vector<Node *> root, int level, int maxLevel);
+  template <typename Pool>
+  static void PrintTreeRec(Pool & pool, std::vector<NodeRef> root, int level, int maxLevel);
   static void PrintSpaces(int num, char chr=' ');
 };
 
+/* A vector with a fixed capacity that lives wherever it is declared.
+ * Used for search paths so that tree operations never touch the heap.
+ */
+template <typename T, int N>
+class FixedVector
+{
+public:
+  FixedVector()
+    :count(0)
+  {
+
+  }
+
+  void push_back(const T & item)
+  {
+    assert(count < N);
+    items[count++] = item;
+  }
+
+  void clear()
+  {
+    count = 0;
+  }
+
+  int size() const
+  {
+    return count;
+  }
+
+  T & at(int i)
+  {
+    assert(i >= 0 && i < count);
+    return items[i];
+  }
+private:
+  T items[N];
+  int count;
+};
+
+template <typename Pool>
+void TreeUtil::PrintTree(Pool & pool, NodeRef root)
+{
+#if defined(PRINT_TREE) && defined(DEBUG)
+  // get the maximum height and convert to count of nodes, not edges
+  int maxHeight = GetNodeHeight(pool, root) + 1;
+
+  std::vector<NodeRef> list;
+  list.push_back(root);
+
+  PrintTreeRec(pool, list, 1, maxHeight);
+#endif
+}
+
+template <typename Pool>
+int TreeUtil::GetNodeHeight(Pool & pool, NodeRef node)
+{
+  if(!node)
+    return -1;
+
+  return std::max(GetNodeHeight(pool, pool.Get(node)->getLeft()),
+      GetNodeHeight(pool, pool.Get(node)->getRight())) + 1;
+}
+
+template <typename Pool>
+int TreeUtil::GetNumNodes(Pool & pool, NodeRef node)
+{
+  if(!node)
+    return 0;
+
+  return GetNumNodes(pool, pool.Get(node)->getLeft()) +
+    GetNumNodes(pool, pool.Get(node)->getRight()) + 1;
+}
+
+template <typename Pool>
+int TreeUtil::FreeAll(Pool & pool, NodeRef node)
+{
+  if(!node)
+    return 0;
+
+  // postorder free
+  int freed = FreeAll(pool, pool.Get(node)->getLeft()) +
+    FreeAll(pool, pool.Get(node)->getRight());
+
+  pool.Free(node);
+
+  return freed + 1;
+}
+
+// Taken and adapted from http://stackoverflow.com/a/4973083/5768099
+// Not used to solve the project. Only for debug
+template <typename Pool>
+void TreeUtil::PrintTreeRec(Pool & pool, std::vector<NodeRef> nodes, int level, int maxLevel)
+{
+  int nonNull = 0;
+
+  for(int i = 0; i < nodes.size(); i++)
+    if(nodes.at(i) != NO_NODE)
+      nonNull++;
+
+  if(nodes.size() == 0 || nonNull == 0)
+    return;
+
+  int floor = maxLevel - level;
+  int endgeLines = (int) pow(2, (std::max(floor - 1, 0)));
+  int firstSpaces = (int) pow(2, (floor)) - 1;
+  int betweenSpaces = (int) pow(2, (floor + 1)) - 1;
+
+  PrintSpaces(firstSpaces);
+
+  std::vector<NodeRef> newNodes;
+  for(int i = 0; i < nodes.size(); i++) {
+    NodeRef node = nodes.at(i);
+
+    if (node != NO_NODE) {
+        Print(pool.Get(node)->getId());
+        newNodes.push_back(pool.Get(node)->getLeft());
+        newNodes.push_back(pool.Get(node)->getRight());
+    } else {
+        putchar(' ');
+        newNodes.push_back(NO_NODE);
+        newNodes.push_back(NO_NODE);
+    }
+
+    PrintSpaces(betweenSpaces);
+  }
+
+  putchar('\n');
+
+  for (int i = 1; i <= endgeLines; i++) {
+    for (int j = 0; j < nodes.size(); j++) {
+      PrintSpaces(firstSpaces - i);
+
+      if (nodes.at(j) == NO_NODE) {
+        PrintSpaces(endgeLines + endgeLines + i + 1);
+        continue;
+      }
+
+      if (pool.Get(nodes.at(j))->getLeft() != NO_NODE)
+        putchar('/');
+      else
+        putchar(' ');
+
+      PrintSpaces(i + i - 1);
+
+      if (pool.Get(nodes.at(j))->getRight() != NO_NODE)
+        putchar('\\');
+      else
+        putchar(' ');
+
+      PrintSpaces(endgeLines + endgeLines - i);
+    }
+
+    puts("");
+  }
+
+  PrintTreeRec(pool, newNodes, level + 1, maxLevel);
+}
+
+inline void TreeUtil::PrintSpaces(int num, char chr)
+{
+  for(int i = 0; i < num; i++)
+    putchar(chr);
+}
+
 }
 
 #endif
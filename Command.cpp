@@ -0,0 +1,227 @@
+#include "Command.h"
+
+#include <cstring>
+
+static const char * const names[] = {
+  NULL, "increase", "reduce", "next", "count", "previous", "inrange", "quit",
+  "rank", "select", "distinct", "quantile", "stats"
+};
+
+// Tokens are separated by spaces or tabs, and a line may end in a carriage
+// return (DOS line endings)
+static bool isBlank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Parses a decimal integer with an optional sign and truncates it to 32
+// bits, like the old stream parsing did. No digits reads as 0
+static uint32_t scanArg(const char *& p, const char * end)
+{
+  while(p != end && isBlank(*p))
+    p++;
+
+  bool negative = false;
+
+  if(p != end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+
+  uint32_t value = 0;
+
+  while(p != end && (unsigned char)(*p - '0') < 10)
+    value = value * 10 + (*p++ - '0');
+
+  // skip whatever is left of the token
+  while(p != end && !isBlank(*p))
+    p++;
+
+  return negative ? 0u - value : value;
+}
+
+// Parses a percentage like "99.9" in to millionths. Digits past the fourth
+// decimal are ignored. Anything over 100 reads as QUANTILE_SCALE + 1, which
+// quantile rejects, and anything else as 0
+static uint32_t scanPercent(const char *& p, const char * end)
+{
+  while(p != end && isBlank(*p))
+    p++;
+
+  uint32_t value = 0;
+  int decimals = -1;
+  bool tooBig = false;
+
+  while(p != end && ((unsigned char)(*p - '0') < 10 || (*p == '.' && decimals < 0)))
+  {
+    if(*p == '.')
+      decimals = 0;
+    else if(decimals < 0)
+    {
+      // stop before a long integer part can wrap around
+      if(!tooBig && (value = value * 10 + (*p - '0')) > 100)
+        tooBig = true;
+    }
+    else if(decimals < 4)
+    {
+      value = value * 10 + (*p - '0');
+      decimals++;
+    }
+
+    p++;
+  }
+
+  // skip whatever is left of the token
+  bool malformed = p != end && !isBlank(*p);
+
+  while(p != end && !isBlank(*p))
+    p++;
+
+  if(malformed)
+    return 0;
+
+  if(tooBig)
+    return QUANTILE_SCALE + 1;
+
+  for(decimals = decimals < 0 ? 0 : decimals; decimals < 4; decimals++)
+    value *= 10;
+
+  return value;
+}
+
+bool parseCommand(const char * line, size_t len, Command & cmd)
+{
+  const char * end = line + len;
+  const char * word = line;
+
+  while(word != end && !isBlank(*word))
+    word++;
+
+  size_t wordLen = word - line;
+
+  cmd.op = 0;
+
+  // Only a few commands share their first letter
+  switch(wordLen ? line[0] : 0)
+  {
+    case 'i':
+      if(wordLen == 8 && !memcmp(line, "increase", 8))
+        cmd.op = OP_INCREASE;
+      else if(wordLen == 7 && !memcmp(line, "inrange", 7))
+        cmd.op = OP_INRANGE;
+      break;
+    case 'r':
+      if(wordLen == 6 && !memcmp(line, "reduce", 6))
+        cmd.op = OP_REDUCE;
+      else if(wordLen == 4 && !memcmp(line, "rank", 4))
+        cmd.op = OP_RANK;
+      break;
+    case 's':
+      if(wordLen == 6 && !memcmp(line, "select", 6))
+        cmd.op = OP_SELECT;
+      else if(wordLen == 5 && !memcmp(line, "stats", 5))
+        cmd.op = OP_STATS;
+      break;
+    case 'd':
+      if(wordLen == 8 && !memcmp(line, "distinct", 8))
+        cmd.op = OP_DISTINCT;
+      break;
+    case 'n':
+      if(wordLen == 4 && !memcmp(line, "next", 4))
+        cmd.op = OP_NEXT;
+      break;
+    case 'c':
+      if(wordLen == 5 && !memcmp(line, "count", 5))
+        cmd.op = OP_COUNT;
+      break;
+    case 'p':
+      if(wordLen == 8 && !memcmp(line, "previous", 8))
+        cmd.op = OP_PREVIOUS;
+      break;
+    case 'q':
+      if(wordLen == 4 && !memcmp(line, "quit", 4))
+        cmd.op = OP_QUIT;
+      else if(wordLen == 8 && !memcmp(line, "quantile", 8))
+        cmd.op = OP_QUANTILE;
+      break;
+  }
+
+  if(!cmd.op)
+    return false;
+
+  const char * p = word;
+
+  cmd.id = cmd.op == OP_QUANTILE ? scanPercent(p, end) : scanArg(p, end);
+  cmd.arg = scanArg(p, end);
+
+  return true;
+}
+
+const char * commandName(uint32_t op)
+{
+  if(op < OP_INCREASE || op >= sizeof(names) / sizeof(names[0]))
+    return NULL;
+
+  return names[op];
+}
+
+static void putU32(char * p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+static uint32_t getU32(const char * p)
+{
+  const unsigned char * u = reinterpret_cast<const unsigned char *>(p);
+
+  return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+void encodeCommand(const Command & cmd, char * record)
+{
+  putU32(record, cmd.op);
+  putU32(record + 4, cmd.id);
+  putU32(record + 8, cmd.arg);
+}
+
+void decodeCommand(const char * record, Command & cmd)
+{
+  cmd.op = getU32(record);
+  cmd.id = getU32(record + 4);
+  cmd.arg = getU32(record + 8);
+}
+
+void formatResult(OutputBuffer & out, const Result & result)
+{
+  // These print "id count", which is "0 0" with no match
+  if(result.op == OP_NEXT || result.op == OP_PREVIOUS || result.op == OP_SELECT ||
+      result.op == OP_QUANTILE)
+  {
+    out.putUInt(result.id);
+    out.putChar(' ');
+  }
+
+  out.putInt(result.value);
+  out.putChar('\n');
+}
+
+void encodeResult(OutputBuffer & out, const Result & result)
+{
+  char record[BINARY_RESULT_SIZE];
+  uint64_t value = result.value;
+
+  putU32(record, result.op);
+  putU32(record + 4, result.id);
+  putU32(record + 8, value);
+  putU32(record + 12, value >> 32);
+
+  out.putBytes(record, BINARY_RESULT_SIZE);
+}
+
+void decodeResult(const char * record, Result & result)
+{
+  result.op = getU32(record);
+  result.id = getU32(record + 4);
+  result.value = (long long)(getU32(record + 8) | ((uint64_t)getU32(record + 12) << 32));
+}
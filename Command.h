@@ -0,0 +1,217 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <utility>
+
+#include "Probes.h"
+#include "util.h"
+
+// Commands understood by bbst. The values are part of the binary format
+enum opcode_t
+{
+  OP_INCREASE = 1,
+  OP_REDUCE = 2,
+  OP_NEXT = 3,
+  OP_COUNT = 4,
+  OP_PREVIOUS = 5,
+  OP_INRANGE = 6,
+  OP_QUIT = 7,
+  OP_RANK = 8,
+  OP_SELECT = 9,
+  OP_DISTINCT = 10,
+  OP_QUANTILE = 11,
+  // Prints the tree statistics (see AVLStats.h). Has no result
+  OP_STATS = 12
+};
+
+// quantile takes a percentage, which is stored in millionths (parts per
+// million of the total) so 99.9% is exact
+const uint32_t QUANTILE_SCALE = 1000000;
+
+struct Command
+{
+  uint32_t op;
+  // The ID, the rank for select, or the fraction for quantile
+  uint32_t id;
+  // The amount for increase and reduce (as a signed int) or the right
+  // end of the range for inrange and distinct
+  uint32_t arg;
+};
+
+struct Result
+{
+  uint32_t op;
+  // The matched ID for next, previous, select and quantile. 0 when there
+  // was no match
+  uint32_t id;
+  // The count, the range sum for inrange, or the number of IDs for
+  // rank and distinct
+  long long value;
+};
+
+/* Binary formats. All fields are little endian.
+ *
+ *   Command - 12 bytes: u32 opcode, u32 id, u32 arg
+ *   Result  - 16 bytes: u32 opcode, u32 id, i64 value
+ *
+ * Commands that print nothing in text mode (increase/reduce with a
+ * non-positive amount, quit) produce no result record either.
+ */
+const size_t BINARY_COMMAND_SIZE = 12;
+const size_t BINARY_RESULT_SIZE = 16;
+
+// Parses one line of the text format. Returns false if the command is
+// unknown. Missing or malformed numbers read as 0. quantile reads a
+// percentage with up to four decimals, like "99.9"
+bool parseCommand(const char * line, size_t len, Command & cmd);
+// Returns the text name of an opcode, or NULL for an unknown one
+const char * commandName(uint32_t op);
+
+void encodeCommand(const Command & cmd, char * record);
+void decodeCommand(const char * record, Command & cmd);
+
+// Writes a result in the text format, e.g. "12" or "1024 3"
+void formatResult(OutputBuffer & out, const Result & result);
+void encodeResult(OutputBuffer & out, const Result & result);
+void decodeResult(const char * record, Result & result);
+
+// Finds the key at which the running total reaches fraction millionths of
+// the total. The target is rounded up in integers, so it doesn't matter how
+// big the total is
+template <typename TreeT>
+bool quantile(TreeT & tree, uint32_t fraction,
+    std::pair<typename TreeT::key_type, typename TreeT::value_type> & match)
+{
+  typename TreeT::sum_type total = tree.Total();
+
+  if(fraction > QUANTILE_SCALE)
+    return false;
+
+  typename TreeT::sum_type target = total / QUANTILE_SCALE * fraction +
+      ((total % QUANTILE_SCALE) * fraction + QUANTILE_SCALE - 1) / QUANTILE_SCALE;
+
+  return tree.WeightedSelect(target, match);
+}
+
+// Does the work of executeQuery
+template <typename TreeT>
+bool runQuery(TreeT & tree, const Command & cmd, Result & result)
+{
+  std::pair<typename TreeT::key_type, typename TreeT::value_type> match;
+
+  result.op = cmd.op;
+  result.id = 0;
+
+  switch(cmd.op)
+  {
+    case OP_NEXT:
+    case OP_PREVIOUS:
+      if(cmd.op == OP_NEXT ? tree.Next(cmd.id, match) : tree.Previous(cmd.id, match))
+      {
+        result.id = match.first;
+        result.value = match.second;
+      }
+      else
+      {
+        result.value = 0;
+      }
+
+      return true;
+    case OP_COUNT:
+      result.value = tree.Count(cmd.id);
+      return true;
+    case OP_INRANGE:
+      result.value = tree.InRange(cmd.id, cmd.arg);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Whether runQuery handles cmd
+inline bool isQuery(const Command & cmd)
+{
+  return cmd.op == OP_NEXT || cmd.op == OP_PREVIOUS || cmd.op == OP_COUNT || cmd.op == OP_INRANGE;
+}
+
+// Does the work of executeCommand
+template <typename TreeT>
+bool runCommand(TreeT & tree, const Command & cmd, Result & result)
+{
+  std::pair<typename TreeT::key_type, typename TreeT::value_type> match;
+  int amount = (int32_t)cmd.arg;
+
+  result.op = cmd.op;
+  result.id = 0;
+
+  switch(cmd.op)
+  {
+    case OP_INCREASE:
+      // the tree ignores non-positive amounts and so do we
+      if(amount <= 0)
+        return false;
+
+      result.value = tree.Increase(cmd.id, amount);
+      return true;
+    case OP_REDUCE:
+      if(amount <= 0)
+        return false;
+
+      result.value = tree.Reduce(cmd.id, amount);
+      return true;
+    case OP_SELECT:
+    case OP_QUANTILE:
+      if(cmd.op == OP_SELECT ? tree.Select((int32_t)cmd.id, match) :
+          quantile(tree, cmd.id, match))
+      {
+        result.id = match.first;
+        result.value = match.second;
+      }
+      else
+      {
+        result.value = 0;
+      }
+
+      return true;
+    case OP_RANK:
+      result.value = tree.Rank(cmd.id);
+      return true;
+    case OP_DISTINCT:
+      result.value = tree.CountDistinct(cmd.id, cmd.arg);
+      return true;
+    default:
+      return runQuery(tree, cmd, result);
+  }
+}
+
+// Runs cmd against tree between the tracepoints in Probes.h. Returns
+// false if the command has no result
+template <typename TreeT>
+bool executeCommand(TreeT & tree, const Command & cmd, Result & result)
+{
+  PROBE_COMMAND_START(cmd.op, cmd.id, cmd.arg);
+
+  bool hasResult = runCommand(tree, cmd, result);
+
+  PROBE_COMMAND_DONE(cmd.op, result.id, hasResult ? result.value : 0);
+
+  return hasResult;
+}
+
+// Like executeCommand, for trees that can only answer the commands in
+// runQuery (such as AVL::FrozenTree)
+template <typename TreeT>
+bool executeQuery(TreeT & tree, const Command & cmd, Result & result)
+{
+  PROBE_COMMAND_START(cmd.op, cmd.id, cmd.arg);
+
+  bool hasResult = runQuery(tree, cmd, result);
+
+  PROBE_COMMAND_DONE(cmd.op, result.id, hasResult ? result.value : 0);
+
+  return hasResult;
+}
+
+#endif
@@ -0,0 +1,306 @@
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Journal.h"
+#include "AVLSnapshot.h"
+
+using namespace std;
+
+static const char FILE_MAGIC[8] = { 'A', 'V', 'L', 'J', 'R', 'N', 'L', '\0' };
+static const size_t FILE_HEADER_SIZE = 16;
+// "JRNL" in little endian
+static const uint32_t JOURNAL_MAGIC = 0x4c4e524a;
+static const size_t BLOCK_HEADER_SIZE = 16;
+
+// The journal fails from a background thread, and stdout may be carrying
+// binary results, so this goes to stderr
+static void journalError(const char * what)
+{
+  fprintf(stderr, "fatal: journal %s failed: %s\n", what, strerror(errno));
+  exit(1);
+}
+
+static uint32_t getU32(const unsigned char * p)
+{
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+Journal::Journal()
+  :fd(-1), generation(0), ring(new Command[RING_SIZE]), appended(0), drained(0),
+   cachedDrained(0), stopping(false), durable(0), waiters(0)
+{
+}
+
+Journal::~Journal()
+{
+  if(fd < 0)
+  {
+    delete [] ring;
+    return;
+  }
+
+  {
+    lock_guard<mutex> guard(lock);
+    stopping = true;
+  }
+
+  // The writer commits what is left before it stops
+  wakeWriter.notify_one();
+  writer.join();
+
+  close(fd);
+  delete [] ring;
+}
+
+bool Journal::Open(const char * path, uint32_t first, vector<Command> & replay)
+{
+  fd = open(path, O_RDWR | O_CREAT, 0644);
+
+  if(fd < 0)
+    return false;
+
+  vector<char> data;
+  char chunk[1 << 16];
+  ssize_t got;
+
+  while((got = read(fd, chunk, sizeof(chunk))) != 0)
+  {
+    if(got < 0)
+    {
+      if(errno == EINTR)
+        continue;
+
+      journalError("read");
+    }
+
+    data.insert(data.end(), chunk, chunk + got);
+  }
+
+  // A crash while the journal was being created can leave less than a
+  // header, but never any records. Afterwards the file is just the header
+  size_t magic = min(data.size(), sizeof(FILE_MAGIC));
+
+  if(data.size() < FILE_HEADER_SIZE && (magic == 0 || memcmp(data.data(), FILE_MAGIC, magic) == 0))
+  {
+    StartGeneration(first);
+    data.assign(FILE_HEADER_SIZE, 0);
+  }
+  else if(data.size() < FILE_HEADER_SIZE || memcmp(data.data(), FILE_MAGIC, magic) != 0)
+  {
+    close(fd);
+    fd = -1;
+    return false;
+  }
+  else
+    generation = getU32(reinterpret_cast<const unsigned char *>(data.data()) + 8);
+
+  const unsigned char * bytes = reinterpret_cast<const unsigned char *>(data.data());
+  size_t pos = FILE_HEADER_SIZE;
+
+  replay.clear();
+
+  while(data.size() - pos >= BLOCK_HEADER_SIZE)
+  {
+    uint32_t count = getU32(bytes + pos + 4);
+    size_t len = size_t(count) * BINARY_COMMAND_SIZE;
+
+    if(getU32(bytes + pos) != JOURNAL_MAGIC || data.size() - pos - BLOCK_HEADER_SIZE < len)
+      break;
+
+    AVL::SnapshotChecksum checksum;
+    checksum.Update(data.data() + pos + BLOCK_HEADER_SIZE, len);
+
+    if(checksum.Value() != AVL::SnapshotChecksum::GetU64(bytes + pos + 8))
+      break;
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+      Command cmd;
+
+      decodeCommand(data.data() + pos + BLOCK_HEADER_SIZE + i * BINARY_COMMAND_SIZE, cmd);
+      replay.push_back(cmd);
+    }
+
+    pos += BLOCK_HEADER_SIZE + len;
+  }
+
+  if(generation < first)
+  {
+    // Saved in a snapshot that the journal wasn't reset after
+    replay.clear();
+    StartGeneration(first);
+  }
+  else
+  {
+    // Drop the torn block a crash left behind, so new blocks follow the
+    // last good one
+    if(pos != data.size() && ftruncate(fd, pos) < 0)
+      journalError("truncate");
+
+    if(lseek(fd, pos, SEEK_SET) < 0)
+      journalError("seek");
+  }
+
+  writer = thread(Work, this);
+
+  return true;
+}
+
+void Journal::Sync()
+{
+  unique_lock<mutex> guard(lock);
+  uint64_t target = appended.load();
+
+  if(durable >= target)
+    return;
+
+  waiters++;
+  wakeWriter.notify_one();
+
+  while(durable < target)
+    committed.wait(guard);
+
+  waiters--;
+}
+
+void Journal::Reset()
+{
+  Sync();
+
+  // Nothing is appended any more, so the writer is idle
+  StartGeneration(generation + 1);
+}
+
+void Journal::StartGeneration(uint32_t next)
+{
+  // The records have to be gone for good before the header says they
+  // belong to the new generation
+  if(ftruncate(fd, 0) < 0 || fdatasync(fd) < 0)
+    journalError("reset");
+
+  unsigned char header[FILE_HEADER_SIZE] = { 0 };
+
+  memcpy(header, FILE_MAGIC, sizeof(FILE_MAGIC));
+
+  for(int i = 0; i < 4; i++)
+    header[8 + i] = next >> (8 * i);
+
+  if(pwrite(fd, header, sizeof(header), 0) != ssize_t(sizeof(header)) ||
+      lseek(fd, sizeof(header), SEEK_SET) < 0 || fdatasync(fd) < 0)
+    journalError("reset");
+
+  generation = next;
+}
+
+void Journal::WaitForRoom(uint64_t count)
+{
+  while(count - (cachedDrained = drained.load(memory_order_acquire)) == RING_SIZE)
+  {
+    // The writer checks for a full ring under the lock, so this can't
+    // slip in between its check and its wait
+    {
+      lock_guard<mutex> guard(lock);
+      wakeWriter.notify_one();
+    }
+
+    this_thread::yield();
+  }
+}
+
+void Journal::Work(Journal * journal)
+{
+  vector<char> block;
+  uint64_t drained = 0;
+
+  while(true)
+  {
+    bool stopping;
+
+    {
+      unique_lock<mutex> guard(journal->lock);
+      uint64_t appended = journal->appended.load();
+
+      // Commit right away if someone is waiting for something we haven't
+      // written or the ring is filling up. Otherwise let commands pile up
+      // for a while
+      if(!journal->stopping && !(journal->waiters && journal->durable < appended) &&
+          appended - drained < RING_SIZE / 2)
+        journal->wakeWriter.wait_for(guard, chrono::milliseconds(COMMIT_INTERVAL_MS));
+
+      stopping = journal->stopping;
+    }
+
+    uint32_t count = journal->appended.load(memory_order_acquire) - drained;
+
+    if(count == 0)
+    {
+      if(stopping)
+        break;
+
+      continue;
+    }
+
+    // Leave room for the block header, which WriteBlock fills in
+    block.resize(BLOCK_HEADER_SIZE + size_t(count) * BINARY_COMMAND_SIZE);
+
+    for(uint32_t i = 0; i < count; i++)
+    {
+      encodeCommand(journal->ring[(drained + i) & (RING_SIZE - 1)],
+          &block[BLOCK_HEADER_SIZE + i * BINARY_COMMAND_SIZE]);
+    }
+
+    // The appender can reuse those slots while we write
+    drained += count;
+    journal->drained.store(drained, memory_order_release);
+
+    journal->WriteBlock(block, count);
+
+    lock_guard<mutex> guard(journal->lock);
+    journal->durable += count;
+    journal->committed.notify_all();
+  }
+}
+
+void Journal::WriteBlock(vector<char> & block, uint32_t count)
+{
+  AVL::SnapshotChecksum checksum;
+  unsigned char * header = reinterpret_cast<unsigned char *>(&block[0]);
+
+  checksum.Update(&block[BLOCK_HEADER_SIZE], block.size() - BLOCK_HEADER_SIZE);
+
+  for(int i = 0; i < 4; i++)
+  {
+    header[i] = JOURNAL_MAGIC >> (8 * i);
+    header[4 + i] = count >> (8 * i);
+  }
+
+  AVL::SnapshotChecksum::PutU64(header + 8, checksum.Value());
+
+  // The header and the records go out in one write
+  size_t written = 0;
+
+  while(written < block.size())
+  {
+    ssize_t ret = write(fd, block.data() + written, block.size() - written);
+
+    if(ret < 0)
+    {
+      if(errno == EINTR)
+        continue;
+
+      journalError("write");
+    }
+
+    written += ret;
+  }
+
+  if(fdatasync(fd) < 0)
+    journalError("sync");
+}
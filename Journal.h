@@ -0,0 +1,106 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+#include "Command.h"
+
+/* Write-ahead journal of the commands that change the tree.
+ *
+ * Append only copies the command in to a ring, without taking a lock or
+ * waiting for anything unless the ring is full. A background thread writes whatever has piled up as one
+ * block and syncs it, so many commands share a single fdatasync (group
+ * commit). It commits at least every COMMIT_INTERVAL_MS, and right away
+ * when someone waits in Sync. Calling Sync before results are written out
+ * means nothing is reported that could still be lost in a crash.
+ *
+ * File format: a 16 byte file header (8 byte magic "AVLJRNL\0", u32
+ * generation, u32 reserved 0), then a sequence of blocks, each a 16 byte
+ * header (u32 magic, u32 number of records, u64 checksum of the records)
+ * followed by the commands as binary command records (see Command.h). A
+ * crash can leave a partly written block at the end. Open stops at the
+ * first block that is incomplete or fails its checksum and cuts the file
+ * off there.
+ *
+ * Reset empties the journal and moves it on to the next generation. A
+ * snapshot saved before a Reset records that next generation (see
+ * AVLSnapshot.h), so if a crash comes between the two, Open can tell that
+ * the commands left in the journal are in the snapshot already.
+ */
+class Journal
+{
+  public:
+    Journal();
+    ~Journal();
+
+    // Reads the commands already in the journal at path (creating it if
+    // needed) in to replay and starts appending after them. A journal
+    // older than generation holds nothing the tree doesn't, so it is
+    // emptied and moved on to generation instead. False if the file can't
+    // be opened or isn't a journal
+    bool Open(const char * path, uint32_t generation, std::vector<Command> & replay);
+
+    // Records a command. Only one thread may append, but any thread can Sync
+    void Append(const Command & cmd)
+    {
+      uint64_t count = appended.load(std::memory_order_relaxed);
+
+      if(count - cachedDrained == RING_SIZE)
+        WaitForRoom(count);
+
+      ring[count & (RING_SIZE - 1)] = cmd;
+
+      // Publishes the record to the writer and to Sync
+      appended.store(count + 1, std::memory_order_release);
+    }
+
+    // Returns once everything appended so far is on disk
+    void Sync();
+    // Syncs and then empties the journal, once what it holds has been
+    // saved some other way (like a snapshot) along with Generation() + 1
+    void Reset();
+    uint32_t Generation() const { return generation; }
+  private:
+    // not copyable
+    Journal(const Journal &);
+    Journal & operator=(const Journal &);
+
+    void WaitForRoom(uint64_t count);
+    // Empties the file and then writes a header for the new generation
+    void StartGeneration(uint32_t next);
+    static void Work(Journal * journal);
+    void WriteBlock(std::vector<char> & block, uint32_t count);
+  private:
+    static constexpr int COMMIT_INTERVAL_MS = 10;
+    static const uint64_t RING_SIZE = 1 << 18;
+
+    int fd;
+    uint32_t generation;
+    std::thread writer;
+
+    // Commands appended but not yet copied out by the writer are
+    // ring[drained, appended), indices taken modulo RING_SIZE
+    Command * ring;
+    alignas(64) std::atomic<uint64_t> appended;
+    alignas(64) std::atomic<uint64_t> drained;
+    // The appender's last look at drained
+    alignas(64) uint64_t cachedDrained;
+
+    std::mutex lock;
+    // Signals the writer that there is a waiter or that we are stopping
+    std::condition_variable wakeWriter;
+    // Signals waiters that more is durable
+    std::condition_variable committed;
+    bool stopping;
+
+    // Commands on disk, counted since Open like appended
+    uint64_t durable;
+    int waiters;
+};
+
+#endif
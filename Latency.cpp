@@ -0,0 +1,105 @@
+#include <cmath>
+#include <csignal>
+#include <pthread.h>
+#include <thread>
+
+#include "Latency.h"
+#include "Command.h"
+
+using namespace std;
+
+LatencyHistogram::LatencyHistogram()
+  :count(0), max(0)
+{
+  for(int i = 0; i < NUM_BUCKETS; i++)
+    buckets[i].store(0, memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::BucketTop(int bucket)
+{
+  if(bucket < (1 << SUB_BITS))
+    return bucket;
+
+  int shift = (bucket >> SUB_BITS) - 1;
+  uint64_t mantissa = (bucket & ((1 << SUB_BITS) - 1)) + (1 << SUB_BITS);
+
+  return ((mantissa + 1) << shift) - 1;
+}
+
+uint64_t LatencyHistogram::Percentile(double p) const
+{
+  uint64_t total = Count();
+  // The rank of the value we want, counting from 1. The slack keeps
+  // 0.99 * 100 from rounding up to 100
+  uint64_t rank = uint64_t(ceil(p * total - 1e-9));
+  uint64_t seen = 0;
+
+  if(rank == 0)
+    rank = 1;
+
+  for(int i = 0; i < NUM_BUCKETS; i++)
+  {
+    seen += buckets[i].load(memory_order_relaxed);
+
+    if(seen >= rank)
+      return min(BucketTop(i), Max());
+  }
+
+  return Max();
+}
+
+LatencyRecorder::LatencyRecorder()
+  :startTicks(readCycles())
+{
+  clock_gettime(CLOCK_MONOTONIC, &startTime);
+}
+
+void LatencyRecorder::Dump(FILE * out)
+{
+  struct timespec now;
+  uint64_t ticks = readCycles() - startTicks;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  double ns = (now.tv_sec - startTime.tv_sec) * 1e9 + (now.tv_nsec - startTime.tv_nsec);
+  double nsPerTick = ticks ? ns / ticks : 1;
+
+  for(uint32_t op = 0; op < MAX_OPS; op++)
+  {
+    const LatencyHistogram & histogram = histograms[op];
+
+    if(!histogram.Count() || !commandName(op))
+      continue;
+
+    fprintf(out, "latency: %-8s count %llu p50 %.0fns p99 %.0fns p99.9 %.0fns max %.0fns\n",
+        commandName(op), (unsigned long long)histogram.Count(),
+        histogram.Percentile(0.5) * nsPerTick, histogram.Percentile(0.99) * nsPerTick,
+        histogram.Percentile(0.999) * nsPerTick, histogram.Max() * nsPerTick);
+  }
+
+  fflush(out);
+}
+
+void LatencyRecorder::DumpOnSignal(int signal)
+{
+  sigset_t set;
+
+  sigemptyset(&set);
+  sigaddset(&set, signal);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  // Waits for the signal until the process exits
+  thread(WaitForSignal, this, signal).detach();
+}
+
+void LatencyRecorder::WaitForSignal(LatencyRecorder * recorder, int signal)
+{
+  sigset_t set;
+  int received;
+
+  sigemptyset(&set);
+  sigaddset(&set, signal);
+
+  while(sigwait(&set, &received) == 0)
+    recorder->Dump(stderr);
+}
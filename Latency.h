@@ -0,0 +1,119 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <atomic>
+#include <cstdio>
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// A cheap, steadily ticking counter: the TSC on x86, nanoseconds elsewhere.
+// LatencyRecorder works out how long a tick is
+inline uint64_t readCycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/* Histogram of latencies in ticks, bucketed like HdrHistogram: exact below
+ * 2^SUB_BITS, then 2^SUB_BITS buckets per power of two, so any value is
+ * off by less than 1 / 2^SUB_BITS (about 3%).
+ *
+ * Only one thread may Record, but any thread can read at the same time.
+ * The counters are atomics that are only ever loaded and stored, so
+ * recording costs the same as with plain integers.
+ */
+class LatencyHistogram
+{
+  public:
+    LatencyHistogram();
+
+    void Record(uint64_t ticks)
+    {
+      Bump(buckets[Bucket(ticks)]);
+      Bump(count);
+
+      if(ticks > max.load(std::memory_order_relaxed))
+        max.store(ticks, std::memory_order_relaxed);
+    }
+
+    uint64_t Count() const { return count.load(std::memory_order_relaxed); }
+    uint64_t Max() const { return max.load(std::memory_order_relaxed); }
+    // The highest value in the bucket holding the p-th (0 to 1) fraction
+    // of the values, but no more than Max
+    uint64_t Percentile(double p) const;
+  private:
+    static const int SUB_BITS = 5;
+    static const int NUM_BUCKETS = (64 - SUB_BITS + 1) << SUB_BITS;
+
+    static void Bump(std::atomic<uint64_t> & counter)
+    {
+      counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static int Bucket(uint64_t ticks)
+    {
+      if(ticks < (uint64_t(1) << SUB_BITS))
+        return ticks;
+
+      // The top SUB_BITS + 1 bits pick the bucket
+      int shift = 63 - __builtin_clzll(ticks) - SUB_BITS;
+
+      return ((shift + 1) << SUB_BITS) + (ticks >> shift) - (1 << SUB_BITS);
+    }
+
+    static uint64_t BucketTop(int bucket);
+  private:
+    std::atomic<uint64_t> buckets[NUM_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> max;
+};
+
+/* Latency histograms for each command type, printed in ns.
+ *
+ * Ticks are turned in to ns by comparing the ticks and the time passed
+ * since the recorder was made, so no calibration is needed up front.
+ */
+class LatencyRecorder
+{
+  public:
+    LatencyRecorder();
+
+    // From one thread only (see LatencyHistogram)
+    void Record(uint32_t op, uint64_t ticks)
+    {
+      if(op < MAX_OPS)
+        histograms[op].Record(ticks);
+    }
+
+    // Prints count, p50, p99, p99.9 and max of every command type seen
+    void Dump(FILE * out);
+    // Dumps to stderr whenever the process gets signal, from a thread of
+    // its own. Call before any other thread is started, as they have to
+    // inherit the blocked signal
+    void DumpOnSignal(int signal);
+  private:
+    // not copyable
+    LatencyRecorder(const LatencyRecorder &);
+    LatencyRecorder & operator=(const LatencyRecorder &);
+
+    static void WaitForSignal(LatencyRecorder * recorder, int signal);
+  private:
+    static const uint32_t MAX_OPS = 16;
+
+    LatencyHistogram histograms[MAX_OPS];
+
+    uint64_t startTicks;
+    struct timespec startTime;
+};
+
+#endif
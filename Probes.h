@@ -0,0 +1,55 @@
+#ifndef PROBES_H
+#define PROBES_H
+
+#include <stdint.h>
+
+/* Static tracepoints around every command run against a tree, so perf or
+ * bpftrace can time commands without a rebuild:
+ *
+ *   command_start(op, id, arg)   before the tree is called
+ *   command_done(op, id, value)  after, with the result value
+ *
+ * With sys/sdt.h (systemtap-sdt-dev) these are USDT probes in provider
+ * bbst, which are a single nop until something attaches:
+ *
+ *   bpftrace -e 'usdt:./bbst:bbst:command_done { @[arg0] = count(); }'
+ *
+ * Without it they are calls to the empty functions below, which cost a few
+ * ns and can be attached to as uprobes instead:
+ *
+ *   bpftrace -e 'uprobe:./bbst:bbst_command_done { @[arg0] = count(); }'
+ */
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define BBST_HAVE_SDT
+#endif
+#endif
+
+#ifdef BBST_HAVE_SDT
+
+#include <sys/sdt.h>
+
+#define PROBE_COMMAND_START(op, id, arg) DTRACE_PROBE3(bbst, command_start, op, id, arg)
+#define PROBE_COMMAND_DONE(op, id, value) DTRACE_PROBE3(bbst, command_done, op, id, value)
+
+#else
+
+// The asm keeps the calls and their arguments from being optimized away
+extern "C" __attribute__((noinline, used))
+inline void bbst_command_start(uint32_t op, uint32_t id, uint32_t arg)
+{
+  asm volatile("" : : "r"(op), "r"(id), "r"(arg));
+}
+
+extern "C" __attribute__((noinline, used))
+inline void bbst_command_done(uint32_t op, uint32_t id, long long value)
+{
+  asm volatile("" : : "r"(op), "r"(id), "r"(value));
+}
+
+#define PROBE_COMMAND_START(op, id, arg) bbst_command_start(op, id, arg)
+#define PROBE_COMMAND_DONE(op, id, value) bbst_command_done(op, id, value)
+
+#endif
+
+#endif
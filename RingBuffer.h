@@ -0,0 +1,174 @@
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+
+/* A bounded queue between exactly one producer thread and one consumer
+ * thread. Each side works on private copies of the indices and only
+ * touches the shared ones once per BATCH items (or before it would wait),
+ * so the cache line holding them doesn't bounce on every command.
+ *
+ * Items pushed become visible to the consumer at the next publish(), and
+ * slots popped are handed back to the producer at the next release().
+ * Both happen automatically every BATCH items and before blocking, so a
+ * side that is about to wait on something other than the ring (like a
+ * read(2)) should call them itself first.
+ *
+ * A side that has nothing to do spins briefly and then sleeps on a
+ * condition variable until the other side publishes or releases.
+ */
+template <typename T, size_t N, size_t BATCH = 64>
+class RingBuffer
+{
+  static_assert((N & (N - 1)) == 0, "ring size must be a power of two");
+  static_assert(BATCH > 0 && BATCH < N && (BATCH & (BATCH - 1)) == 0,
+      "batch size must be a power of two smaller than the ring");
+
+public:
+  RingBuffer()
+    :head(0), tail(0), waiters(0), writePos(0), cachedHead(0),
+     readPos(0), cachedTail(0)
+  {
+  }
+
+  // Producer side. Returns false if the ring is full
+  bool tryPush(const T & item)
+  {
+    if(writePos - cachedHead == N)
+    {
+      cachedHead = head.load(std::memory_order_acquire);
+
+      if(writePos - cachedHead == N)
+        return false;
+    }
+
+    slots[writePos & (N - 1)] = item;
+    writePos++;
+
+    if((writePos & (BATCH - 1)) == 0)
+      publish();
+
+    return true;
+  }
+
+  void push(const T & item)
+  {
+    while(!tryPush(item))
+    {
+      publish();
+      wait(&RingBuffer::hasSpace);
+    }
+  }
+
+  void publish()
+  {
+    if(tail.load(std::memory_order_relaxed) == writePos)
+      return;
+
+    tail.store(writePos, std::memory_order_seq_cst);
+    wake();
+  }
+
+  // Consumer side. Returns false if nothing has been published
+  bool tryPop(T & item)
+  {
+    if(readPos == cachedTail)
+    {
+      cachedTail = tail.load(std::memory_order_acquire);
+
+      if(readPos == cachedTail)
+        return false;
+    }
+
+    item = slots[readPos & (N - 1)];
+    readPos++;
+
+    if((readPos & (BATCH - 1)) == 0)
+      release();
+
+    return true;
+  }
+
+  void pop(T & item)
+  {
+    while(!tryPop(item))
+    {
+      release();
+      wait(&RingBuffer::hasItems);
+    }
+  }
+
+  void release()
+  {
+    if(head.load(std::memory_order_relaxed) == readPos)
+      return;
+
+    head.store(readPos, std::memory_order_seq_cst);
+    wake();
+  }
+
+private:
+  // not copyable
+  RingBuffer(const RingBuffer &);
+  RingBuffer & operator=(const RingBuffer &);
+
+  bool hasSpace() const { return writePos - head.load() != N; }
+  bool hasItems() const { return readPos != tail.load(); }
+
+  void wait(bool (RingBuffer::*ready)() const)
+  {
+    for(int i = 0; i < SPIN_COUNT; i++)
+    {
+      if((this->*ready)())
+        return;
+
+      std::this_thread::yield();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // The other side checks waiters after storing its index, and we check
+    // its index after announcing ourselves, so one of us sees the other
+    waiters.fetch_add(1);
+
+    while(!(this->*ready)())
+      cond.wait(lock);
+
+    waiters.fetch_sub(1);
+  }
+
+  void wake()
+  {
+    if(waiters.load() == 0)
+      return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    cond.notify_all();
+  }
+
+private:
+  static const int SPIN_COUNT = 64;
+
+  T slots[N];
+
+  // Shared indices, each on its own cache line
+  alignas(64) std::atomic<size_t> head;
+  alignas(64) std::atomic<size_t> tail;
+  alignas(64) std::atomic<int> waiters;
+  std::mutex mutex;
+  std::condition_variable cond;
+
+  // Producer's view
+  alignas(64) size_t writePos;
+  size_t cachedHead;
+
+  // Consumer's view
+  alignas(64) size_t readPos;
+  size_t cachedTail;
+};
+
+#endif
@@ -0,0 +1,291 @@
+#include <algorithm>
+
+#include "ShardedTree.h"
+
+using namespace std;
+
+ShardedTree::ShardedTree(int numShards)
+  :requestedShards(numShards), fingerSearch(false), finished(false),
+   pending(false)
+{
+}
+
+ShardedTree::~ShardedTree()
+{
+  if(!finished)
+    Finish();
+
+  for(size_t i = 0; i < shards.size(); i++)
+  {
+    shards[i]->worker.join();
+    delete shards[i];
+  }
+}
+
+void ShardedTree::SetFingerSearch(bool enabled)
+{
+  fingerSearch = enabled;
+}
+
+void ShardedTree::BuildFromSortedList(const vector<pair<AVL::ID, int> > & nodes)
+{
+  // Every shard gets at least one node to start with
+  int numShards = max(1, min(requestedShards, int(nodes.size())));
+
+  for(int i = 0; i < numShards; i++)
+  {
+    size_t begin = nodes.size() * i / numShards;
+    size_t end = nodes.size() * (i + 1) / numShards;
+
+    Shard * shard = new Shard;
+    shard->tree.SetFingerSearch(fingerSearch);
+    shard->tree.BuildFromSortedList(vector<pair<AVL::ID, int> >(nodes.begin() + begin, nodes.begin() + end));
+
+    shards.push_back(shard);
+    bounds.push_back(i == 0 ? 0 : nodes[begin].first);
+
+    ShardState state;
+    GetState(shard->tree, state);
+    states.push_back(state);
+  }
+
+  for(int i = 0; i < numShards; i++)
+    shards[i]->worker = thread(Work, this, i);
+}
+
+int ShardedTree::ShardOf(AVL::ID id)
+{
+  return upper_bound(bounds.begin() + 1, bounds.end(), id) - bounds.begin() - 1;
+}
+
+void ShardedTree::GetState(AVL::Tree & tree, ShardState & state)
+{
+  state.size = tree.Size();
+
+  if(state.size)
+  {
+    state.first = *tree.Begin();
+    state.last = *--tree.End();
+  }
+}
+
+void ShardedTree::UpdateState(AVL::Tree & tree, AVL::ID id, int count, ShardState & state)
+{
+  bool wasEmpty = state.size == 0;
+
+  state.size = tree.Size();
+
+  if(state.size == 0)
+    return;
+
+  if(wasEmpty)
+  {
+    state.first = state.last = make_pair(id, count);
+    return;
+  }
+
+  // The ends only move for a write at or past one of them. A count of 0
+  // means the ID isn't in the tree, and only then do we have to look
+  if(id <= state.first.first)
+  {
+    if(count)
+      state.first = make_pair(id, count);
+    else if(id == state.first.first)
+      state.first = *tree.Begin();
+  }
+
+  if(id >= state.last.first)
+  {
+    if(count)
+      state.last = make_pair(id, count);
+    else if(id == state.last.first)
+      state.last = *--tree.End();
+  }
+}
+
+void ShardedTree::Complete(ShardResult & answer)
+{
+  Result & result = answer.result;
+  int owner = route.first;
+
+  // Counts in the tree are positive, so a value of 0 means next or
+  // previous found nothing in the owner
+  switch(route.op)
+  {
+    case OP_NEXT:
+      for(size_t i = owner + 1; i < states.size() && result.value == 0; i++)
+      {
+        if(states[i].size)
+        {
+          result.id = states[i].first.first;
+          result.value = states[i].first.second;
+        }
+      }
+      break;
+    case OP_PREVIOUS:
+      for(int i = owner - 1; i >= 0 && result.value == 0; i--)
+      {
+        if(states[i].size)
+        {
+          result.id = states[i].last.first;
+          result.value = states[i].last.second;
+        }
+      }
+      break;
+    case OP_RANK:
+      for(int i = 0; i < owner; i++)
+        result.value += states[i].size;
+      break;
+  }
+}
+
+void ShardedTree::Submit(const Command & cmd)
+{
+  Route route;
+  int owner = ShardOf(cmd.id);
+
+  route.op = cmd.op;
+  route.first = route.last = owner;
+
+  switch(cmd.op)
+  {
+    case OP_INRANGE:
+    case OP_DISTINCT:
+      // an empty range only needs one shard to say 0
+      if(cmd.arg >= cmd.id)
+        route.last = ShardOf(cmd.arg);
+      break;
+  }
+
+  for(int i = route.first; i <= route.last; i++)
+    Push(i, cmd);
+
+  if(!routes.tryPush(route))
+  {
+    Flush();
+    routes.push(route);
+  }
+}
+
+void ShardedTree::Push(int shard, const Command & cmd)
+{
+  // Another shard may be sitting on commands we haven't published, and
+  // the collector could be waiting on those. Publish everything before
+  // we wait
+  if(!shards[shard]->commands.tryPush(cmd))
+  {
+    Flush();
+    shards[shard]->commands.push(cmd);
+  }
+}
+
+void ShardedTree::Flush()
+{
+  for(size_t i = 0; i < shards.size(); i++)
+    shards[i]->commands.publish();
+
+  routes.publish();
+}
+
+void ShardedTree::Finish()
+{
+  Command end = { 0, 0, 0 };
+  Route last = { 0, 0, -1 };
+
+  for(size_t i = 0; i < shards.size(); i++)
+    Push(i, end);
+
+  routes.push(last);
+  Flush();
+
+  finished = true;
+}
+
+ShardedTree::collect_status_t ShardedTree::Collect(Result & result, bool wait)
+{
+  while(true)
+  {
+    if(!pending)
+    {
+      if(!routes.tryPop(route))
+      {
+        if(!wait)
+          return COLLECT_EMPTY;
+
+        routes.pop(route);
+      }
+
+      if(route.op == 0)
+        return COLLECT_END;
+
+      pending = true;
+      nextShard = route.first;
+    }
+
+    for(; nextShard <= route.last; nextShard++)
+    {
+      RingBuffer<ShardResult, 4096> & results = shards[nextShard]->results;
+      ShardResult partial;
+
+      if(!results.tryPop(partial))
+      {
+        if(!wait)
+          return COLLECT_EMPTY;
+
+        results.pop(partial);
+      }
+
+      if(partial.changed)
+        states[nextShard] = partial.state;
+
+      if(nextShard == route.first)
+        combined = partial;
+      else
+        combined.result.value += partial.result.value;
+    }
+
+    pending = false;
+    Complete(combined);
+
+    if(combined.hasResult)
+    {
+      result = combined.result;
+      return COLLECT_OK;
+    }
+  }
+}
+
+void ShardedTree::Work(ShardedTree * sharded, int index)
+{
+  Shard & shard = *sharded->shards[index];
+  Command cmd;
+  ShardResult partial;
+  ShardState state;
+
+  GetState(shard.tree, state);
+
+  while(true)
+  {
+    if(!shard.commands.tryPop(cmd))
+    {
+      shard.results.publish();
+      shard.commands.pop(cmd);
+    }
+
+    if(cmd.op == 0)
+      break;
+
+    partial.hasResult = executeCommand(shard.tree, cmd, partial.result);
+    partial.changed = partial.hasResult && (cmd.op == OP_INCREASE || cmd.op == OP_REDUCE);
+
+    if(partial.changed)
+    {
+      UpdateState(shard.tree, cmd.id, partial.result.value, state);
+      partial.state = state;
+    }
+
+    shard.results.push(partial);
+  }
+
+  shard.results.publish();
+}
@@ -0,0 +1,139 @@
+#ifndef SHARDEDTREE_H
+#define SHARDEDTREE_H
+
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "AVLTree.h"
+#include "Command.h"
+#include "RingBuffer.h"
+
+/* Runs commands against a tree split in to ID range shards, each its own
+ * AVL::Tree with its own worker thread.
+ *
+ * One thread submits commands and one thread collects the results, which
+ * come out in command order exactly as executeCommand on a single tree
+ * would produce them. increase, reduce, count, next, previous and rank go
+ * to the shard owning the ID, so they cost one shard each. inrange and
+ * distinct go to every shard the range overlaps, and the partial answers
+ * are added up.
+ *
+ * After each increase or reduce, the shard also reports its size and its
+ * smallest and largest keys. The new count of the ID usually tells it
+ * where its ends are, and it only searches its tree when one of them was
+ * removed. The collector keeps these, in command order,
+ * for every shard. When the owner has no next (or previous) key, the
+ * answer is the smallest (or largest) key of the nearest non-empty shard
+ * above (or below) it. rank adds the sizes of the shards below the owner.
+ * Both scan the collector's list of shards, which costs much less than
+ * asking each of them.
+ *
+ * select and quantile aren't supported, as a shard can't tell which of its
+ * keys has a given rank or running total without knowing the sizes and
+ * sums of the shards below it.
+ */
+class ShardedTree
+{
+  public:
+    ShardedTree(int numShards);
+    ~ShardedTree();
+
+    void SetFingerSearch(bool enabled);
+
+    // Splits nodes in to shards of about the same size and starts the
+    // workers. Call once, before the first Submit
+    void BuildFromSortedList(const std::vector<std::pair<AVL::ID, int> > & nodes);
+
+    // Submitting side
+    void Submit(const Command & cmd);
+    // Hand everything submitted so far to the workers. Call before
+    // blocking on something else so the results keep flowing
+    void Flush();
+    // No more commands. The workers stop once they are done. Everything
+    // up to here has to be collected before the tree is destroyed
+    void Finish();
+
+    // Collecting side
+    enum collect_status_t
+    {
+      COLLECT_OK,
+      // Only returned when not waiting
+      COLLECT_EMPTY,
+      // Every result up to Finish() has been collected
+      COLLECT_END
+    };
+
+    // Returns the result of the next command that has one
+    collect_status_t Collect(Result & result, bool wait);
+  private:
+    // not copyable
+    ShardedTree(const ShardedTree &);
+    ShardedTree & operator=(const ShardedTree &);
+
+    int ShardOf(AVL::ID id);
+    void Push(int shard, const Command & cmd);
+    static void Work(ShardedTree * sharded, int shard);
+  private:
+    // A shard's size and its smallest and largest keys with their counts
+    struct ShardState
+    {
+      int size;
+      std::pair<AVL::ID, int> first;
+      std::pair<AVL::ID, int> last;
+    };
+
+    // What a shard worker sends back for each command
+    struct ShardResult
+    {
+      Result result;
+      // false if the command printed nothing
+      bool hasResult;
+      // Set after an increase or reduce, with the shard's new state
+      bool changed;
+      ShardState state;
+    };
+
+    // Which shards a command went to. op 0 marks the end
+    struct Route
+    {
+      uint32_t op;
+      int first;
+      int last;
+    };
+
+    struct Shard
+    {
+      AVL::Tree tree;
+      RingBuffer<Command, 4096> commands;
+      RingBuffer<ShardResult, 4096> results;
+      std::thread worker;
+    };
+
+    static void GetState(AVL::Tree & tree, ShardState & state);
+    // Brings state up to date after a write that left id with count
+    static void UpdateState(AVL::Tree & tree, AVL::ID id, int count, ShardState & state);
+    // Fills in next, previous and rank from the other shards, once the
+    // owner has answered
+    void Complete(ShardResult & answer);
+
+    int requestedShards;
+    bool fingerSearch;
+    bool finished;
+
+    std::vector<Shard *> shards;
+    // bounds[i] is the smallest ID shard i owns. bounds[0] is unused
+    std::vector<AVL::ID> bounds;
+    RingBuffer<Route, 4096> routes;
+
+    // Every shard as of the last command collected
+    std::vector<ShardState> states;
+
+    // The collector's place in a partly combined result
+    bool pending;
+    Route route;
+    int nextShard;
+    ShardResult combined;
+};
+
+#endif
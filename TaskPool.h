@@ -0,0 +1,238 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Fork-join thread pool with work stealing.
+ *
+ * Invoke(left, right) offers right to the other threads and runs left
+ * itself. If nobody took right by then, it runs that too, so a pool that
+ * is busy elsewhere costs little more than two plain calls. Each thread
+ * keeps its own queue of offered tasks. It takes work from the newest end
+ * of its own queue and steals from the oldest end of the others', which
+ * hands out the biggest pieces of a recursive split first.
+ *
+ * A thread waiting for a stolen task runs other tasks in the meantime,
+ * so Invoke can nest as deeply as the recursion needs.
+ */
+class TaskPool
+{
+  public:
+    // threads counts the thread calling Invoke. 0 means one per core
+    explicit TaskPool(int threads = 0)
+      :stopping(false), queued(0)
+    {
+      if(threads <= 0)
+        threads = std::thread::hardware_concurrency();
+
+      if(threads <= 0)
+        threads = 1;
+
+      // queue 0 belongs to whichever outside thread calls Invoke
+      for(int i = 0; i < threads; i++)
+        queues.push_back(new Queue);
+
+      for(int i = 1; i < threads; i++)
+        workers.push_back(std::thread(&TaskPool::Work, this, i));
+    }
+
+    ~TaskPool()
+    {
+      {
+        std::lock_guard<std::mutex> lock(sleepLock);
+        stopping = true;
+      }
+
+      wakeUp.notify_all();
+
+      for(size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+      for(size_t i = 0; i < queues.size(); i++)
+        delete queues[i];
+    }
+
+    // Number of threads that run tasks
+    int Size() const
+    {
+      return queues.size();
+    }
+
+    // Runs left and right, possibly at the same time, and returns when
+    // both are done. Only one thread outside the pool may use it at a time
+    template <typename F, typename G>
+    void Invoke(F left, G right)
+    {
+      int self = Self();
+      Task task;
+
+      task.run = &Call<G>;
+      task.arg = &right;
+      task.done.store(false);
+
+      Push(self, &task);
+
+      left();
+
+      // Nested calls in left() have taken their own tasks back, so ours is
+      // the newest one in our queue unless somebody stole it
+      if(TakeBack(self, &task))
+      {
+        right();
+        return;
+      }
+
+      while(!task.done.load(std::memory_order_acquire))
+      {
+        if(!RunOne(self))
+          std::this_thread::yield();
+      }
+    }
+  private:
+    // not copyable
+    TaskPool(const TaskPool &);
+    TaskPool & operator=(const TaskPool &);
+
+    struct Task
+    {
+      void (*run)(void *);
+      void * arg;
+      std::atomic<bool> done;
+    };
+
+    struct alignas(64) Queue
+    {
+      std::mutex lock;
+      std::deque<Task *> tasks;
+    };
+
+    struct Current
+    {
+      TaskPool * pool;
+      int index;
+    };
+
+    template <typename G>
+    static void Call(void * arg)
+    {
+      (*static_cast<G *>(arg))();
+    }
+
+    static Current & ThisThread()
+    {
+      static thread_local Current current = { NULL, 0 };
+
+      return current;
+    }
+
+    int Self()
+    {
+      Current & current = ThisThread();
+
+      return current.pool == this ? current.index : 0;
+    }
+
+    void Push(int self, Task * task)
+    {
+      {
+        std::lock_guard<std::mutex> lock(queues[self]->lock);
+        queues[self]->tasks.push_back(task);
+      }
+
+      queued.fetch_add(1);
+
+      if(!workers.empty())
+      {
+        std::lock_guard<std::mutex> lock(sleepLock);
+        wakeUp.notify_one();
+      }
+    }
+
+    bool TakeBack(int self, Task * task)
+    {
+      std::lock_guard<std::mutex> lock(queues[self]->lock);
+      std::deque<Task *> & tasks = queues[self]->tasks;
+
+      if(tasks.empty() || tasks.back() != task)
+        return false;
+
+      tasks.pop_back();
+      queued.fetch_sub(1);
+
+      return true;
+    }
+
+    // Runs one task from our own queue or, failing that, someone else's.
+    // Returns false if there was none
+    bool RunOne(int self)
+    {
+      Task * task = NULL;
+
+      for(size_t i = 0; i < queues.size() && !task; i++)
+      {
+        Queue & queue = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.lock);
+
+        if(queue.tasks.empty())
+          continue;
+
+        if(i == 0)
+        {
+          task = queue.tasks.back();
+          queue.tasks.pop_back();
+        }
+        else
+        {
+          task = queue.tasks.front();
+          queue.tasks.pop_front();
+        }
+      }
+
+      if(!task)
+        return false;
+
+      queued.fetch_sub(1);
+
+      task->run(task->arg);
+      task->done.store(true, std::memory_order_release);
+
+      return true;
+    }
+
+    void Work(int index)
+    {
+      Current & current = ThisThread();
+      current.pool = this;
+      current.index = index;
+
+      while(true)
+      {
+        if(RunOne(index))
+          continue;
+
+        std::unique_lock<std::mutex> lock(sleepLock);
+
+        while(!stopping && queued.load() == 0)
+          wakeUp.wait(lock);
+
+        if(stopping)
+          return;
+      }
+    }
+  private:
+    std::vector<Queue *> queues;
+    std::vector<std::thread> workers;
+
+    bool stopping;
+    // Tasks waiting in the queues
+    std::atomic<int> queued;
+    std::mutex sleepLock;
+    std::condition_variable wakeUp;
+};
+
+#endif
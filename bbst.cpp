@@ -2,159 +2,719 @@
 #include <string>
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 #include <vector>
+#include <thread>
+#include <functional>
+#include <csignal>
+#include <unistd.h>
 
 #include "util.h"
+#include "Command.h"
+#include "RingBuffer.h"
+#include "ShardedTree.h"
+#include "Journal.h"
+#include "Latency.h"
 #include "AVLTree.h"
+#include "AVLBTree.h"
 
 using namespace std;
 
-int main(int argc, char * argv[])
+static void usage()
 {
-  if(argc != 2)
-  {
-    printf("fatal: input file required\n");
-    return 1;
-  }
+  printf("usage: bbst [--binary] [--pipeline] [--finger] [--shards n] [--snapshot file]\n");
+  printf("            [--journal file] [--latency] [--frozen] [--btree] input_file\n");
+  printf("  --binary    read binary commands and write binary results (see Command.h)\n");
+  printf("  --pipeline  parse, execute and format commands on separate threads\n");
+  printf("  --finger    start each search from the last node used (for sorted commands)\n");
+  printf("  --shards n  split the tree in to n ID ranges, each run by its own thread\n");
+  printf("  --snapshot file  save the tree to file when the commands are done\n");
+  printf("  --journal file   log increase and reduce to file, and replay what it\n");
+  printf("                   holds on top of input_file first\n");
+  printf("  --latency   time every command and print percentiles for each kind to\n");
+  printf("              stderr at the end, or on SIGUSR1\n");
+  printf("  --frozen    answer from a read-only copy of the tree, which is faster\n");
+  printf("              but only takes count, next, previous, inrange and stats\n");
+  printf("  --btree     keep the IDs in a B+tree instead of the AVL tree\n");
+  printf("input_file can be a tree file or a snapshot\n");
+}
 
-  char * filename = argv[1];
+enum read_status_t
+{
+  READ_OK,
+  READ_END,
+  READ_ERROR
+};
 
-  vector<vector<string> > lines = readInputFile(filename);
-  vector<pair<AVL::ID, int> > nodes;
+// Reads the next command from in. On READ_ERROR error holds the message
+static read_status_t readCommand(InputBuffer & in, bool binary, Command & cmd, string & error)
+{
+  if(binary)
+  {
+    const char * record;
 
-  AVL::ID lastId = 0;
+    if(!in.getBytes(record, BINARY_COMMAND_SIZE))
+      return READ_END;
 
-  for(int i = 0; i < lines.size(); i++)
-  {
-    if(lines[i].size() != 2)
+    decodeCommand(record, cmd);
+
+    if(!commandName(cmd.op))
     {
-      printf("fatal: malformed node input at line %d\n", i+1);
-      return 1;
+      char message[64];
+      snprintf(message, sizeof(message), "fatal: unrecognized opcode %u", cmd.op);
+      error = message;
+      return READ_ERROR;
     }
 
-    int id = readInt(lines[i][0]);
-    int count = readInt(lines[i][1]);
+    return READ_OK;
+  }
 
-    if(id <= 0 || count <= 0)
-    {
-      printf("fatal: malformed node ID(%d) at line %d\n", id, i+1);
-      return 1;
-    }
+  const char * line;
+  size_t len;
 
-    // cast the signed int to an unsigned ID now that we have verified the ID's sanity
-    AVL::ID newId = (AVL::ID)id;
+  do
+  {
+    if(!in.getLine(line, len))
+      return READ_END;
+  } while(len == 0);
 
-    if(lastId >= newId)
-    {
-      printf("fatal: ID was not strictly increasing at line %d\n", i+1);
-      return 1;
-    }
+  if(!parseCommand(line, len, cmd))
+  {
+    const char * space = static_cast<const char *>(memchr(line, ' ', len));
+    size_t wordLen = space ? space - line : len;
+
+    error = "fatal: unrecognized command '" + string(line, wordLen) + "'";
+    return READ_ERROR;
+  }
+
+  return READ_OK;
+}
+
+static bool inputReady(InputBuffer & in, bool binary)
+{
+  return binary ? in.hasBytes(BINARY_COMMAND_SIZE) : in.hasLine();
+}
+
+static void writeResult(OutputBuffer & out, bool binary, const Result & result)
+{
+  if(binary)
+    encodeResult(out, result);
+  else
+    formatResult(out, result);
+}
+
+// Whether cmd changes the tree, and so goes in the journal
+static bool changesTree(const Command & cmd)
+{
+  return (cmd.op == OP_INCREASE || cmd.op == OP_REDUCE) && (int32_t)cmd.arg > 0;
+}
 
-    lastId = newId;
+// Output flush hook. Results may only be reported once the commands that
+// produced them can't be lost
+static void syncJournal(void * journal)
+{
+  static_cast<Journal *>(journal)->Sync();
+}
+
+static void openOutput(OutputBuffer & out, Journal * journal)
+{
+  if(journal)
+    out.setFlushHook(syncJournal, journal);
+}
+
+// Statistics go to stderr, so the results stay the same
+static void printStats(AVL::Tree & tree)
+{
+  AVL::TreeStats stats = tree.Stats();
+
+  fprintf(stderr, "stats: nodes %zu height %d optimal %d heap_bytes %zu node_bytes %zu\n",
+      stats.nodes, stats.height, stats.optimalHeight, stats.heapBytes, stats.nodeBytes);
+
+  if(!stats.counting)
+  {
+    fprintf(stderr, "stats: counters off, build with -DAVL_STATS\n");
+    return;
+  }
+
+  fprintf(stderr, "stats: rotations LR %llu RR %llu LRR %llu RLR %llu\n",
+      stats.rotations[AVL::ROTATE_LR], stats.rotations[AVL::ROTATE_RR],
+      stats.rotations[AVL::ROTATE_LRR], stats.rotations[AVL::ROTATE_RLR]);
+  fprintf(stderr, "stats: inserts %llu removes %llu retraced %llu inrange %llu inrange_nodes %llu\n",
+      stats.inserts, stats.removes, stats.retraced, stats.rangeQueries, stats.rangeNodes);
 
-    nodes.push_back(pair<AVL::ID, int>(newId, count));
+  // "length:searches" for the lengths that occurred
+  fprintf(stderr, "stats: path_lengths");
+
+  for(int i = 0; i <= AVL::MAX_HEIGHT; i++)
+  {
+    if(stats.pathLengths[i])
+      fprintf(stderr, " %d:%llu", i, stats.pathLengths[i]);
   }
 
-  AVL::Tree tree;
+  fprintf(stderr, "\n");
+}
 
-  // Build the tree in O(n) time
-  tree.BuildFromSortedList(nodes);
+static void printStats(AVL::FrozenTree & tree)
+{
+  fprintf(stderr, "stats: frozen nodes %zu bytes %zu\n", tree.Size(), tree.Bytes());
+}
+
+static void printStats(AVL::BTree & tree)
+{
+  fprintf(stderr, "stats: btree nodes %zu levels %d bytes %zu\n", tree.Size(), tree.Levels(), tree.Bytes());
+}
+
+// Whether tree can run cmd. Sets error if not
+static bool supported(AVL::Tree &, const Command &, string &)
+{
+  return true;
+}
+
+static bool supported(AVL::BTree &, const Command &, string &)
+{
+  return true;
+}
+
+static bool supported(AVL::FrozenTree &, const Command & cmd, string & error)
+{
+  if(isQuery(cmd) || cmd.op == OP_STATS || cmd.op == OP_QUIT)
+    return true;
+
+  error = string("fatal: ") + commandName(cmd.op) + " is not supported with --frozen";
+  return false;
+}
+
+static bool execute(AVL::Tree & tree, const Command & cmd, Result & result)
+{
+  return executeCommand(tree, cmd, result);
+}
+
+static bool execute(AVL::BTree & tree, const Command & cmd, Result & result)
+{
+  return executeCommand(tree, cmd, result);
+}
+
+static bool execute(AVL::FrozenTree & tree, const Command & cmd, Result & result)
+{
+  return executeQuery(tree, cmd, result);
+}
 
 #ifdef DEBUG
+static void debugTree(AVL::Tree & tree, const char * when)
+{
   tree.PrintTree();
   if(!tree.IsSane())
   {
-    printf("Tree is INSANE after creation\n");
+    printf("Tree is INSANE %s\n", when);
+    exit(1);
+  }
+}
+
+static void debugTree(AVL::BTree & tree, const char * when)
+{
+  if(!tree.IsSane())
+  {
+    printf("Tree is INSANE %s\n", when);
     exit(1);
   }
+}
+
+static void debugTree(AVL::FrozenTree &, const char *)
+{
+}
 #endif
 
-  bool bQuit = false;
+// Binary results go to stdout, so errors go to stderr there
+static void fatalError(bool binary, const string & error)
+{
+  fprintf(binary ? stderr : stdout, "%s\n", error.c_str());
+  exit(1);
+}
+
+// Runs cmd, timing it if latency is given
+template <typename TreeT>
+static bool timeCommand(TreeT & tree, const Command & cmd, Result & result,
+    LatencyRecorder * latency)
+{
+  if(!latency)
+    return execute(tree, cmd, result);
+
+  uint64_t start = readCycles();
+  bool hasResult = execute(tree, cmd, result);
+
+  latency->Record(cmd.op, readCycles() - start);
+
+  return hasResult;
+}
+
+template <typename TreeT>
+static void runSequential(TreeT & tree, bool binary, Journal * journal,
+    LatencyRecorder * latency)
+{
+  // Commands are read and results written in large batches
+  InputBuffer in(STDIN_FILENO);
+  OutputBuffer out(STDOUT_FILENO);
+  openOutput(out, journal);
 
-  while(!bQuit)
+  Command cmd;
+  Result result;
+  string error;
+
+  while(true)
   {
-    string line;
-    getline(cin, line);
+    // Flush before we could block on input so interactive use still works
+    if(!inputReady(in, binary))
+      out.flush();
+
+    read_status_t status = readCommand(in, binary, cmd, error);
 
-    if(!cin)
+    if(status == READ_END)
       break;
 
-    vector<string> args = getTokens(line);
-    int numArgs = args.size();
+    if(status == READ_ERROR || !supported(tree, cmd, error))
+    {
+      out.flush();
+      fatalError(binary, error);
+    }
 
-    if(numArgs == 0)
-      continue;
+#ifdef DEBUG
+    printf("%s %u %u\n", commandName(cmd.op), cmd.id, cmd.arg);
+#endif
 
-    string cmd = args[0];
-    AVL::ID id = (AVL::ID)readInt(args[1]);
+    if(cmd.op == OP_QUIT)
+      break;
 
-    if(cmd == "increase")
-    {
-      int count = readInt(args[2]);
+    if(journal && changesTree(cmd))
+      journal->Append(cmd);
+
+    if(cmd.op == OP_STATS)
+      printStats(tree);
+
+    if(timeCommand(tree, cmd, result, latency))
+      writeResult(out, binary, result);
 
 #ifdef DEBUG
-      printf("ID %u += %d\n", id, count);
+  // keep the debug output in order with the results
+  fflush(stdout);
+  out.flush();
+  debugTree(tree, "after last command");
 #endif
+  }
+}
+
+/* The pipeline: this thread parses, one thread runs the commands against
+ * the tree and one formats the results. Each stage hands its output to the
+ * next in order through a ring, and op 0 marks the end of the stream.
+ * Like the sequential loop, every stage pushes out what it has before it
+ * waits for more so interactive use still works.
+ */
+typedef RingBuffer<Command, 4096> CommandRing;
+typedef RingBuffer<Result, 4096> ResultRing;
 
-      tree.Increase(id, count);
+template <typename TreeT>
+static void executeStage(TreeT & tree, CommandRing & commands, ResultRing & results,
+    LatencyRecorder * latency)
+{
+  Command cmd;
+  Result result;
+
+  while(true)
+  {
+    if(!commands.tryPop(cmd))
+    {
+      results.publish();
+      commands.pop(cmd);
     }
-    else if(cmd == "reduce")
+
+    if(cmd.op == 0)
+      break;
+
+    if(cmd.op == OP_STATS)
+      printStats(tree);
+
+    if(timeCommand(tree, cmd, result, latency))
+      results.push(result);
+  }
+
+  result.op = 0;
+  results.push(result);
+  results.publish();
+}
+
+static void outputStage(ResultRing & results, bool binary, Journal * journal)
+{
+  OutputBuffer out(STDOUT_FILENO);
+  openOutput(out, journal);
+  Result result;
+
+  while(true)
+  {
+    if(!results.tryPop(result))
     {
-      int count = readInt(args[2]);
+      out.flush();
+      results.pop(result);
+    }
 
-#ifdef DEBUG
-      printf("ID %u -= %d\n", id, count);
-#endif
+    if(result.op == 0)
+      break;
+
+    writeResult(out, binary, result);
+  }
+
+  out.flush();
+}
+
+template <typename TreeT>
+static void runPipeline(TreeT & tree, bool binary, Journal * journal,
+    LatencyRecorder * latency)
+{
+  InputBuffer in(STDIN_FILENO);
+  CommandRing * commands = new CommandRing;
+  ResultRing * results = new ResultRing;
+
+  thread executor(executeStage<TreeT>, ref(tree), ref(*commands), ref(*results), latency);
+  thread output(outputStage, ref(*results), binary, journal);
+
+  Command cmd;
+  string error;
+  read_status_t status;
+
+  while(true)
+  {
+    if(!inputReady(in, binary))
+      commands->publish();
 
-      tree.Reduce(id, count);
+    status = readCommand(in, binary, cmd, error);
+
+    if(status != READ_OK || cmd.op == OP_QUIT)
+      break;
+
+    if(!supported(tree, cmd, error))
+    {
+      status = READ_ERROR;
+      break;
     }
-    else if(cmd == "next")
+
+    // Logged ahead of running it, like everywhere else
+    if(journal && changesTree(cmd))
+      journal->Append(cmd);
+
+    commands->push(cmd);
+  }
+
+  cmd.op = 0;
+  commands->push(cmd);
+  commands->publish();
+
+  executor.join();
+  output.join();
+
+  delete commands;
+  delete results;
+
+  // Everything before the bad command has been written by now
+  if(status == READ_ERROR)
+    fatalError(binary, error);
+}
+
+static void collectStage(ShardedTree & sharded, bool binary, Journal * journal)
+{
+  OutputBuffer out(STDOUT_FILENO);
+  openOutput(out, journal);
+  Result result;
+
+  while(true)
+  {
+    ShardedTree::collect_status_t status = sharded.Collect(result, false);
+
+    if(status == ShardedTree::COLLECT_EMPTY)
     {
-#ifdef DEBUG
-      printf("ID %u next\n", id);
-#endif
-      tree.Next(id);
+      out.flush();
+      status = sharded.Collect(result, true);
     }
-    else if(cmd == "count")
+
+    if(status == ShardedTree::COLLECT_END)
+      break;
+
+    writeResult(out, binary, result);
+  }
+
+  out.flush();
+}
+
+// Like the pipeline, but the shard workers take the place of the execute
+// stage and the output thread puts their results back together
+static void runSharded(const vector<pair<AVL::ID, int> > & nodes, int numShards,
+    bool finger, bool binary, Journal * journal)
+{
+  ShardedTree sharded(numShards);
+  sharded.SetFingerSearch(finger);
+  sharded.BuildFromSortedList(nodes);
+
+  InputBuffer in(STDIN_FILENO);
+  thread output(collectStage, ref(sharded), binary, journal);
+
+  Command cmd;
+  string error;
+  read_status_t status;
+
+  while(true)
+  {
+    if(!inputReady(in, binary))
+      sharded.Flush();
+
+    status = readCommand(in, binary, cmd, error);
+
+    if(status != READ_OK || cmd.op == OP_QUIT)
+      break;
+
+    if(cmd.op == OP_SELECT || cmd.op == OP_QUANTILE || cmd.op == OP_STATS)
     {
-#ifdef DEBUG
-      printf("ID %u count\n", id);
-#endif
-      tree.Count(id);
+      error = string("fatal: ") + commandName(cmd.op) + " is not supported with --shards";
+      status = READ_ERROR;
+      break;
     }
-    else if(cmd == "previous")
+
+    if(journal && changesTree(cmd))
+      journal->Append(cmd);
+
+    sharded.Submit(cmd);
+  }
+
+  sharded.Finish();
+  output.join();
+
+  if(status == READ_ERROR)
+    fatalError(binary, error);
+}
+
+int main(int argc, char * argv[])
+{
+  bool binary = false;
+  bool pipeline = false;
+  bool finger = false;
+  bool timing = false;
+  bool frozen = false;
+  bool btree = false;
+  int shards = 0;
+  char * filename = NULL;
+  char * snapshot = NULL;
+  char * journalFile = NULL;
+
+  for(int i = 1; i < argc; i++)
+  {
+    if(strcmp(argv[i], "--binary") == 0)
+      binary = true;
+    else if(strcmp(argv[i], "--pipeline") == 0)
+      pipeline = true;
+    else if(strcmp(argv[i], "--finger") == 0)
+      finger = true;
+    else if(strcmp(argv[i], "--latency") == 0)
+      timing = true;
+    else if(strcmp(argv[i], "--frozen") == 0)
+      frozen = true;
+    else if(strcmp(argv[i], "--btree") == 0)
+      btree = true;
+    else if(strcmp(argv[i], "--shards") == 0 && i + 1 < argc)
     {
-#ifdef DEBUG
-      printf("ID %u previous\n", id);
-#endif
-      tree.Previous(id);
+      shards = atoi(argv[++i]);
+
+      if(shards < 1)
+      {
+        usage();
+        return 1;
+      }
     }
-    else if(cmd == "inrange")
+    else if(strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc)
+      snapshot = argv[++i];
+    else if(strcmp(argv[i], "--journal") == 0 && i + 1 < argc)
+      journalFile = argv[++i];
+    else if(argv[i][0] == '-')
     {
-      AVL::ID id2 = readInt(args[2]);
+      usage();
+      return 1;
+    }
+    else
+      filename = argv[i];
+  }
+
+  if(!filename)
+  {
+    printf("fatal: input file required\n");
+    return 1;
+  }
+
 #ifdef DEBUG
-      printf("ID1 %u <-> ID2 %u\n", id, id2);
+  // The debug output comes from the tree, so keep it on one thread
+  pipeline = false;
+  shards = 0;
 #endif
-      tree.InRange(id, id2);
+
+  if(shards && snapshot)
+  {
+    printf("fatal: --snapshot is not supported with --shards\n");
+    return 1;
+  }
+
+  if(shards && timing)
+  {
+    printf("fatal: --latency is not supported with --shards\n");
+    return 1;
+  }
+
+  if(frozen && (shards || snapshot))
+  {
+    printf("fatal: --frozen is not supported with --%s\n", shards ? "shards" : "snapshot");
+    return 1;
+  }
+
+  if(btree && (shards || snapshot || frozen || finger))
+  {
+    printf("fatal: --%s is not supported with --btree\n",
+        shards ? "shards" : snapshot ? "snapshot" : frozen ? "frozen" : "finger");
+    return 1;
+  }
+
+  // Never freed, as the signal thread may still be using it as we exit.
+  // Set up before the journal and the pipeline start their threads
+  LatencyRecorder * latency = NULL;
+
+  if(timing)
+  {
+    latency = new LatencyRecorder;
+    latency->DumpOnSignal(SIGUSR1);
+  }
+
+  AVL::Tree tree;
+  AVL::BTree bplusTree;
+  vector<pair<AVL::ID, int> > nodes;
+  // Sharded runs without a journal to replay, and B+tree runs, go straight
+  // from the list
+  bool buildTree = !btree && (!shards || journalFile);
+  // The first journal generation not in the input yet
+  uint32_t generation = 0;
+
+  if(AVL::SnapshotReader::IsSnapshot(filename))
+  {
+    // Decoded straight in to the tree, no text to parse
+    if(!tree.LoadSnapshot(filename, &generation))
+    {
+      printf("fatal: %s is not a valid snapshot\n", filename);
+      return 1;
     }
-    else if(cmd == "quit")
+
+    buildTree = true;
+  }
+  else
+  {
+    // Scans the file in place and validates the IDs as it goes
+    readTreeFile(filename, nodes);
+
+    // Build the tree in O(n) time
+    if(buildTree)
+      tree.BuildFromSortedList(nodes);
+  }
+
+  if(btree)
+  {
+    if(buildTree)
     {
-      bQuit = true;
+      nodes.assign(tree.begin(), tree.end());
+      tree.Clear();
     }
-    else
+
+    bplusTree.BuildFromSortedList(nodes);
+    nodes.clear();
+  }
+
+  Journal journal;
+
+  if(journalFile)
+  {
+    vector<Command> replay;
+    Result result;
+
+    if(!journal.Open(journalFile, generation, replay))
     {
-      printf("fatal: unrecognized command '%s'\n", cmd.c_str());
-      exit(1);
+      printf("fatal: could not open journal %s\n", journalFile);
+      return 1;
     }
 
-#ifdef DEBUG
-  tree.PrintTree();
-  if(!tree.IsSane())
+    for(size_t i = 0; i < replay.size(); i++)
+    {
+      if(btree)
+        executeCommand(bplusTree, replay[i], result);
+      else
+        executeCommand(tree, replay[i], result);
+    }
+  }
+
+  if(shards)
   {
-    printf("Tree is INSANE after last command\n");
-    exit(1);
+    // The shards are built from a list
+    if(buildTree)
+    {
+      nodes.assign(tree.begin(), tree.end());
+      tree.Clear();
+    }
+
+    runSharded(nodes, shards, finger, binary, journalFile ? &journal : NULL);
+    return 0;
   }
+
+  tree.SetFingerSearch(finger);
+
+#ifdef DEBUG
+  debugTree(tree, "after creation");
+#endif
+
+  if(btree)
+  {
+#ifdef DEBUG
+    debugTree(bplusTree, "after creation");
 #endif
+
+    if(pipeline)
+      runPipeline(bplusTree, binary, journalFile ? &journal : NULL, latency);
+    else
+      runSequential(bplusTree, binary, journalFile ? &journal : NULL, latency);
+  }
+  else if(frozen)
+  {
+    // Nothing can change it, so the tree itself isn't needed any more
+    AVL::FrozenTree frozenTree = tree.Freeze();
+    tree.Clear();
+
+    if(pipeline)
+      runPipeline(frozenTree, binary, journalFile ? &journal : NULL, latency);
+    else
+      runSequential(frozenTree, binary, journalFile ? &journal : NULL, latency);
+  }
+  else if(pipeline)
+    runPipeline(tree, binary, journalFile ? &journal : NULL, latency);
+  else
+    runSequential(tree, binary, journalFile ? &journal : NULL, latency);
+
+  if(latency)
+    latency->Dump(stderr);
+
+  if(snapshot)
+  {
+    if(journalFile)
+      generation = journal.Generation() + 1;
+
+    if(!tree.SaveSnapshot(snapshot, generation))
+    {
+      fprintf(binary ? stderr : stdout, "fatal: could not write snapshot %s\n", snapshot);
+      return 1;
+    }
+
+    // Everything in the journal is in the snapshot now, and SaveSnapshot
+    // only returns once the rename is on disk. A crash before the reset
+    // is done leaves the journal a generation behind the snapshot, and
+    // the next Open drops it
+    if(journalFile)
+      journal.Reset();
   }
 
   return 0;
@@ -0,0 +1,117 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "AVLTree.h"
+
+using namespace std;
+
+// Checks that Increase, Reduce, Count and the other queries make no heap
+// allocations once the node pool has grown to the working set. Every
+// allocation goes through the operator new below and is counted. Exits
+// with 1 if the steady state allocated anything.
+// usage: alloc [num_keys] [num_ops]
+
+static atomic<size_t> allocations(0);
+
+void * operator new(size_t size)
+{
+  allocations++;
+
+  if(void * p = malloc(size ? size : 1))
+    return p;
+
+  throw bad_alloc();
+}
+
+void * operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void * operator new(size_t size, align_val_t align)
+{
+  allocations++;
+
+  void * p = NULL;
+
+  if(posix_memalign(&p, size_t(align) < sizeof(void *) ? sizeof(void *) : size_t(align), size ? size : 1) == 0)
+    return p;
+
+  throw bad_alloc();
+}
+
+void * operator new[](size_t size, align_val_t align)
+{
+  return operator new(size, align);
+}
+
+void operator delete(void * p) noexcept { free(p); }
+void operator delete[](void * p) noexcept { free(p); }
+void operator delete(void * p, size_t) noexcept { free(p); }
+void operator delete[](void * p, size_t) noexcept { free(p); }
+void operator delete(void * p, align_val_t) noexcept { free(p); }
+void operator delete[](void * p, align_val_t) noexcept { free(p); }
+void operator delete(void * p, size_t, align_val_t) noexcept { free(p); }
+void operator delete[](void * p, size_t, align_val_t) noexcept { free(p); }
+
+// Keys come and go at random from a fixed range, so the tree stays around
+// half of it
+static void churn(AVL::Tree & tree, AVL::ID range, size_t numOps, unsigned int & seed)
+{
+  pair<AVL::ID, int> match;
+  long long checksum = 0;
+
+  for(size_t i = 0; i < numOps; i++)
+  {
+    AVL::ID id = AVL::ID(rand_r(&seed) % range) + 1;
+
+    switch(rand_r(&seed) % 6)
+    {
+      case 0:
+        checksum += tree.Increase(id, rand_r(&seed) % 3 + 1);
+        break;
+      case 1:
+        checksum += tree.Reduce(id, rand_r(&seed) % 3 + 1);
+        break;
+      case 2:
+        checksum += tree.Count(id);
+        break;
+      case 3:
+        checksum += tree.Next(id, match) ? match.second : 0;
+        break;
+      case 4:
+        checksum += tree.Previous(id, match) ? match.second : 0;
+        break;
+      default:
+        checksum += tree.InRange(id, id + 100);
+        break;
+    }
+  }
+
+  // Keeps the queries from being optimised away
+  if(checksum == -1)
+    printf("%lld\n", checksum);
+}
+
+int main(int argc, char * argv[])
+{
+  size_t numKeys = argc > 1 ? atol(argv[1]) : 100000;
+  size_t numOps = argc > 2 ? atol(argv[2]) : 1000000;
+  AVL::ID range = AVL::ID(numKeys * 2);
+  unsigned int seed = 1;
+
+  AVL::Tree tree;
+
+  // Lets the pool grow to the most nodes the churn will hold at once
+  churn(tree, range, numOps, seed);
+
+  size_t before = allocations.load();
+  churn(tree, range, numOps, seed);
+  size_t allocated = allocations.load() - before;
+
+  printf("%zu operations on %zu keys, %zu allocations\n", numOps, size_t(tree.Stats().nodes), allocated);
+
+  return allocated ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "AVLTree.h"
+#include "AVLBTree.h"
+#include "Command.h"
+#include "Latency.h"
+#include "util.h"
+
+using namespace std;
+
+// Runs a tree file and a text command file (as given to bbst) against the
+// AVL tree and the B+tree, and prints the time to build each and the time
+// per command of each kind. The results are checked against each other.
+// usage: backends tree_file command_file
+
+typedef chrono::steady_clock clock_type;
+
+static const uint32_t MAX_OPS = 16;
+
+template <typename TreeT>
+static void run(const char * name, const vector<pair<AVL::ID, int> > & nodes,
+    const vector<Command> & commands, vector<Result> & results)
+{
+  TreeT tree;
+  uint64_t ticks[MAX_OPS] = { 0 };
+  size_t counts[MAX_OPS] = { 0 };
+
+  clock_type::time_point start = clock_type::now();
+  tree.BuildFromSortedList(nodes);
+  double buildNs = chrono::duration<double, nano>(clock_type::now() - start).count();
+
+  Result result;
+  uint64_t startTicks = readCycles();
+  start = clock_type::now();
+
+  for(size_t i = 0; i < commands.size(); i++)
+  {
+    uint64_t before = readCycles();
+    bool hasResult = executeCommand(tree, commands[i], result);
+
+    ticks[commands[i].op] += readCycles() - before;
+    counts[commands[i].op]++;
+
+    if(hasResult)
+      results.push_back(result);
+  }
+
+  double ns = chrono::duration<double, nano>(clock_type::now() - start).count();
+  uint64_t totalTicks = readCycles() - startTicks;
+  double nsPerTick = totalTicks ? ns / totalTicks : 1;
+
+  printf("%-6s build %.1fms, %zu commands in %.1fms (%.1fns each)\n", name, buildNs / 1e6,
+      commands.size(), ns / 1e6, ns / commands.size());
+
+  for(uint32_t op = 0; op < MAX_OPS; op++)
+  {
+    if(counts[op])
+      printf("%-6s   %-9s %10zu %10.1fns\n", name, commandName(op), counts[op], ticks[op] * nsPerTick / counts[op]);
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  if(argc < 3)
+  {
+    printf("usage: backends tree_file command_file\n");
+    return 1;
+  }
+
+  vector<pair<AVL::ID, int> > nodes;
+  readTreeFile(argv[1], nodes);
+
+  int fd = open(argv[2], O_RDONLY);
+
+  if(fd < 0)
+  {
+    printf("fatal: could not open %s\n", argv[2]);
+    return 1;
+  }
+
+  vector<Command> commands;
+  InputBuffer in(fd);
+  const char * line;
+  size_t len;
+  Command cmd;
+
+  while(in.getLine(line, len))
+  {
+    if(len == 0)
+      continue;
+
+    if(!parseCommand(line, len, cmd))
+    {
+      printf("fatal: unrecognized command in %s\n", argv[2]);
+      return 1;
+    }
+
+    if(cmd.op == OP_QUIT)
+      break;
+
+    // Printed to stderr by bbst, and not part of the work
+    if(cmd.op != OP_STATS)
+      commands.push_back(cmd);
+  }
+
+  close(fd);
+
+  vector<Result> avlResults, btreeResults;
+
+  run<AVL::Tree>("avl", nodes, commands, avlResults);
+  run<AVL::BTree>("btree", nodes, commands, btreeResults);
+
+  for(size_t i = 0; i < avlResults.size(); i++)
+  {
+    if(i >= btreeResults.size() || avlResults[i].id != btreeResults[i].id ||
+        avlResults[i].value != btreeResults[i].value)
+    {
+      printf("fatal: results differ at %zu\n", i);
+      return 1;
+    }
+  }
+
+  return 0;
+}
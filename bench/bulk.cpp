@@ -0,0 +1,98 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "AVLTree.h"
+
+using namespace std;
+
+// Applies sorted batches of increases to a tree one Increase at a time,
+// with BulkIncrease, and with BulkIncrease on a thread pool.
+// usage: bulk [num_keys] [batch_size] [num_batches] [threads]
+
+enum method_t { LOOP, BULK, PARALLEL };
+
+static const char * methodNames[] = { "loop", "bulk", "parallel" };
+
+typedef vector<pair<AVL::ID, int> > batch_t;
+
+static double run(method_t method, const batch_t & nodes,
+    const vector<batch_t> & batches, TaskPool & tasks)
+{
+  AVL::Tree tree;
+  tree.BuildFromSortedList(nodes);
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  for(size_t b = 0; b < batches.size(); b++)
+  {
+    const batch_t & batch = batches[b];
+
+    switch(method)
+    {
+      case LOOP:
+        for(size_t i = 0; i < batch.size(); i++)
+          tree.Increase(batch[i].first, batch[i].second);
+        break;
+      case BULK:
+        tree.BulkIncrease(batch);
+        break;
+      case PARALLEL:
+        tree.BulkIncrease(batch, &tasks);
+        break;
+    }
+  }
+
+  chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+  // keep the work from being optimized out
+  if(tree.InRange(0, AVL::ID(-1)) == 42)
+    printf(" ");
+
+  return elapsed.count();
+}
+
+int main(int argc, char * argv[])
+{
+  size_t numKeys = argc > 1 ? atol(argv[1]) : 1 << 20;
+  size_t batchSize = argc > 2 ? atol(argv[2]) : 1 << 16;
+  size_t numBatches = argc > 3 ? atol(argv[3]) : 32;
+  int threads = argc > 4 ? atoi(argv[4]) : 0;
+
+  // Even IDs in the tree. Batches hit them and the odd IDs between them
+  // about equally, so half the updates insert
+  batch_t nodes;
+
+  for(size_t i = 1; i <= numKeys; i++)
+    nodes.push_back(make_pair(AVL::ID(i * 2), 1));
+
+  vector<batch_t> batches(numBatches);
+
+  srand(1);
+
+  for(size_t b = 0; b < numBatches; b++)
+  {
+    for(size_t i = 0; i < batchSize; i++)
+      batches[b].push_back(make_pair(AVL::ID(1 + rand() % (numKeys * 2)), 1 + rand() % 8));
+
+    sort(batches[b].begin(), batches[b].end());
+  }
+
+  TaskPool tasks(threads);
+
+  printf("# keys %zu, batch %zu, threads %d\n", numKeys, batchSize, tasks.Size());
+  printf("%-10s %12s %14s\n", "method", "ms/batch", "updates/s");
+
+  for(int method = LOOP; method <= PARALLEL; method++)
+  {
+    double seconds = run(method_t(method), nodes, batches, tasks);
+
+    printf("%-10s %12.2f %14.0f\n", methodNames[method],
+        seconds * 1000 / numBatches, batchSize * numBatches / seconds);
+  }
+
+  return 0;
+}
@@ -0,0 +1,95 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "AVLTree.h"
+
+using namespace std;
+
+// Compares plain and finger search on sequential and random key orders.
+// usage: finger [num_keys] [num_ops]
+
+enum op_t { COUNT, NEXT, INCREASE };
+
+static const char * opNames[] = { "count", "next", "increase" };
+
+static double run(AVL::Tree & tree, op_t op, const vector<AVL::ID> & keys)
+{
+  pair<AVL::ID, int> match;
+  long long check = 0;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  for(size_t i = 0; i < keys.size(); i++)
+  {
+    switch(op)
+    {
+      case COUNT:
+        check += tree.Count(keys[i]);
+        break;
+      case NEXT:
+        if(tree.Next(keys[i], match))
+          check += match.first;
+        break;
+      case INCREASE:
+        check += tree.Increase(keys[i], 1);
+        break;
+    }
+  }
+
+  chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+
+  // keep the work from being optimized out
+  if(check == 42)
+    printf(" ");
+
+  return elapsed.count() / keys.size();
+}
+
+int main(int argc, char * argv[])
+{
+  size_t numKeys = argc > 1 ? atol(argv[1]) : 1 << 20;
+  size_t numOps = argc > 2 ? atol(argv[2]) : 1 << 22;
+
+  // Even IDs, so next and count miss half the time with odd ones
+  vector<pair<AVL::ID, int> > nodes;
+
+  for(size_t i = 1; i <= numKeys; i++)
+    nodes.push_back(make_pair(AVL::ID(i * 2), 1));
+
+  vector<AVL::ID> sequential(numOps), random(numOps);
+
+  srand(1);
+
+  for(size_t i = 0; i < numOps; i++)
+  {
+    sequential[i] = 1 + i % (numKeys * 2);
+    random[i] = 1 + rand() % (numKeys * 2);
+  }
+
+  printf("%-10s %-12s %12s %12s\n", "op", "order", "root ns/op", "finger ns/op");
+
+  for(int op = COUNT; op <= INCREASE; op++)
+  {
+    for(int order = 0; order < 2; order++)
+    {
+      double result[2];
+
+      for(int finger = 0; finger < 2; finger++)
+      {
+        AVL::Tree tree;
+        tree.BuildFromSortedList(nodes);
+        tree.SetFingerSearch(finger);
+
+        result[finger] = run(tree, op_t(op), order == 0 ? sequential : random);
+      }
+
+      printf("%-10s %-12s %12.1f %12.1f\n", opNames[op],
+          order == 0 ? "sequential" : "random", result[0], result[1]);
+    }
+  }
+
+  return 0;
+}
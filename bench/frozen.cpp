@@ -0,0 +1,93 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "AVLTree.h"
+
+using namespace std;
+
+// Count, Next, Previous and InRange on a tree and on its frozen copy, with
+// uniformly random keys. Half of the IDs in range are in the tree.
+// usage: frozen [num_keys] [num_queries]
+
+typedef chrono::steady_clock clock_type;
+
+// ns per query. The checksum keeps the queries from being optimised away
+template <typename TreeT>
+static double timeQueries(TreeT & tree, int op, const vector<AVL::ID> & queries, long long & checksum)
+{
+  pair<AVL::ID, int> match;
+  clock_type::time_point start = clock_type::now();
+
+  for(size_t i = 0; i < queries.size(); i++)
+  {
+    AVL::ID id = queries[i];
+
+    switch(op)
+    {
+      case 0:
+        checksum += tree.Count(id);
+        break;
+      case 1:
+        if(tree.Next(id, match))
+          checksum += match.first;
+        break;
+      case 2:
+        if(tree.Previous(id, match))
+          checksum += match.first;
+        break;
+      default:
+        checksum += tree.InRange(id, id + 1000);
+        break;
+    }
+  }
+
+  return chrono::duration<double, nano>(clock_type::now() - start).count() / queries.size();
+}
+
+int main(int argc, char * argv[])
+{
+  size_t maxKeys = argc > 1 ? atol(argv[1]) : 10000000;
+  size_t numQueries = argc > 2 ? atol(argv[2]) : 2000000;
+  const char * ops[] = { "count", "next", "previous", "inrange" };
+
+  printf("%-10s %-9s %10s %10s %8s\n", "keys", "op", "tree_ns", "frozen_ns", "speedup");
+
+  for(size_t keys = 1000; keys <= maxKeys; keys *= 10)
+  {
+    vector<pair<AVL::ID, int> > list;
+
+    for(size_t i = 0; i < keys; i++)
+      list.push_back(make_pair(AVL::ID(i * 2 + 1), int(i % 7 + 1)));
+
+    AVL::Tree tree;
+    tree.BuildFromSortedList(list);
+
+    AVL::FrozenTree frozen = tree.Freeze();
+
+    vector<AVL::ID> queries;
+    srand(1);
+
+    for(size_t i = 0; i < numQueries; i++)
+      queries.push_back(AVL::ID((((size_t)rand() << 16) ^ rand()) % (keys * 2) + 1));
+
+    for(int op = 0; op < 4; op++)
+    {
+      long long treeSum = 0, frozenSum = 0;
+      double treeNs = timeQueries(tree, op, queries, treeSum);
+      double frozenNs = timeQueries(frozen, op, queries, frozenSum);
+
+      if(treeSum != frozenSum)
+      {
+        printf("fatal: %s answers differ\n", ops[op]);
+        return 1;
+      }
+
+      printf("%-10zu %-9s %10.1f %10.1f %7.2fx\n", keys, ops[op], treeNs, frozenNs, treeNs / frozenNs);
+    }
+  }
+
+  return 0;
+}
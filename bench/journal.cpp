@@ -0,0 +1,69 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+#include "Journal.h"
+
+using namespace std;
+
+// Cost per command of journaling, when results are reported (and so the
+// journal synced) every sync_every commands. 0 never waits and leaves the
+// syncs to the background thread alone.
+// usage: journal [num_ops] [file]
+
+static double run(const string & path, size_t numOps, size_t syncEvery)
+{
+  unlink(path.c_str());
+
+  Journal journal;
+  vector<Command> replay;
+
+  if(!journal.Open(path.c_str(), 0, replay))
+  {
+    printf("fatal: could not open %s\n", path.c_str());
+    exit(1);
+  }
+
+  Command cmd = { OP_INCREASE, 0, 1 };
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  for(size_t i = 0; i < numOps; i++)
+  {
+    cmd.id = i;
+    journal.Append(cmd);
+
+    if(syncEvery && (i + 1) % syncEvery == 0)
+      journal.Sync();
+  }
+
+  journal.Sync();
+
+  chrono::duration<double, nano> elapsed = chrono::steady_clock::now() - start;
+
+  return elapsed.count() / numOps;
+}
+
+int main(int argc, char * argv[])
+{
+  size_t numOps = argc > 1 ? atol(argv[1]) : 1 << 22;
+  string path = argc > 2 ? argv[2] : "/tmp/bench_journal";
+  size_t syncEvery[] = { 1, 64, 4096, 65536, 0 };
+
+  printf("%-12s %12s\n", "sync_every", "ns/op");
+
+  for(size_t i = 0; i < sizeof(syncEvery) / sizeof(syncEvery[0]); i++)
+  {
+    // A sync per command is too slow to run the full count
+    size_t ops = syncEvery[i] == 1 ? numOps / 256 : numOps;
+
+    printf("%-12zu %12.1f\n", syncEvery[i], run(path, ops, syncEvery[i]));
+  }
+
+  unlink(path.c_str());
+
+  return 0;
+}
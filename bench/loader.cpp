@@ -0,0 +1,108 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "util.h"
+
+using namespace std;
+
+// Throughput of readTreeFile on tree files like test/test_1000.txt (IDs a
+// few apart, counts 1 to 9), from 10^5 lines up to max_keys, against the
+// getline and stringstream loop it replaced. Files go in to dir. Each is
+// read once beforehand so the page cache is warm for both.
+// usage: loader [max_keys] [dir]
+
+static double seconds(chrono::steady_clock::time_point start)
+{
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// The old way: a line at a time, split through streams
+static void readWithStreams(const char * filename, vector<pair<unsigned int, int> > & nodes)
+{
+  ifstream in(filename);
+  string line;
+  long long items = 0;
+
+  nodes.clear();
+
+  if(getline(in, line))
+    istringstream(line) >> items;
+
+  for(long long i = 0; i < items && getline(in, line); i++)
+  {
+    istringstream tokens(line);
+    unsigned int id;
+    int count;
+
+    tokens >> id >> count;
+    nodes.push_back(make_pair(id, count));
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  size_t maxKeys = argc > 1 ? atol(argv[1]) : 10000000;
+  string dir = argc > 2 ? argv[2] : "/tmp";
+  string path = dir + "/bench_loader.txt";
+
+  printf("%-10s %10s %12s %12s %12s %12s\n", "lines", "MB", "mmap_ms", "mmap_MB/s", "streams_ms", "streams_MB/s");
+
+  for(size_t keys = 100000; keys <= maxKeys; keys *= 10)
+  {
+    FILE * out = fopen(path.c_str(), "w");
+
+    if(!out)
+    {
+      printf("fatal: could not write %s\n", path.c_str());
+      return 1;
+    }
+
+    unsigned int id = 0;
+    srand(1);
+    fprintf(out, "%zu\n", keys);
+
+    for(size_t i = 0; i < keys; i++)
+    {
+      id += rand() % 9 + 1;
+      fprintf(out, "%u %d\n", id, rand() % 9 + 1);
+    }
+
+    fclose(out);
+
+    struct stat info;
+    stat(path.c_str(), &info);
+    double mb = info.st_size / 1e6;
+
+    vector<pair<unsigned int, int> > nodes, check;
+    readTreeFile(path.c_str(), nodes);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    readTreeFile(path.c_str(), nodes);
+    double mmapSeconds = seconds(start);
+
+    start = chrono::steady_clock::now();
+    readWithStreams(path.c_str(), check);
+    double streamSeconds = seconds(start);
+
+    if(nodes != check)
+    {
+      printf("fatal: the loaders disagree on %zu lines\n", keys);
+      return 1;
+    }
+
+    printf("%-10zu %10.1f %12.1f %12.1f %12.1f %12.1f\n", keys, mb, mmapSeconds * 1e3, mb / mmapSeconds,
+        streamSeconds * 1e3, mb / streamSeconds);
+  }
+
+  unlink(path.c_str());
+
+  return 0;
+}
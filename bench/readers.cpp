@@ -0,0 +1,146 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "AVLTree.h"
+#include "AVLConcurrentTree.h"
+
+using namespace std;
+
+// Reader scaling with one busy writer: ConcurrentTree against a Tree
+// behind a global mutex. The tree holds every even ID with a count of 1,
+// which the writer never touches, and the writer adds and removes one odd
+// ID at a time. Every read is checked against that, and any wrong answer
+// fails the run.
+// usage: readers [max_readers] [num_keys] [milliseconds]
+
+// Gives both trees the same interface
+struct LockedTree
+{
+  AVL::Tree tree;
+  mutex lock;
+
+  void BuildFromSortedList(const vector<pair<AVL::ID, int> > & list) { tree.BuildFromSortedList(list); }
+  int Increase(AVL::ID id, int m) { lock_guard<mutex> guard(lock); return tree.Increase(id, m); }
+  int Reduce(AVL::ID id, int m) { lock_guard<mutex> guard(lock); return tree.Reduce(id, m); }
+  int Count(AVL::ID id) { lock_guard<mutex> guard(lock); return tree.Count(id); }
+  long long InRange(AVL::ID l, AVL::ID r) { lock_guard<mutex> guard(lock); return tree.InRange(l, r); }
+};
+
+static unsigned int nextRandom(unsigned int & state)
+{
+  state = state * 1103515245 + 12345;
+  return state >> 8;
+}
+
+// Evens in [left, right] that are in the tree
+static long long evensIn(AVL::ID left, AVL::ID right, size_t numKeys)
+{
+  long long first = max<long long>(2, left + (left & 1));
+  long long last = min<long long>(numKeys * 2, right - (right & 1));
+
+  return last < first ? 0 : (last - first) / 2 + 1;
+}
+
+static atomic<long long> wrongReads(0);
+
+template <typename TreeT>
+static double run(int readers, size_t numKeys, int millis, const vector<pair<AVL::ID, int> > & nodes)
+{
+  TreeT tree;
+  tree.BuildFromSortedList(nodes);
+
+  atomic<bool> stop(false);
+  atomic<long long> reads(0);
+  vector<thread> threads;
+
+  for(int i = 0; i < readers; i++)
+  {
+    threads.push_back(thread([&, i]() {
+      unsigned int state = i + 1;
+      long long done = 0, wrong = 0;
+
+      while(!stop.load(memory_order_relaxed))
+      {
+        AVL::ID id = nextRandom(state) % (numKeys * 2) + 1;
+
+        // mostly point lookups with some range sums. At most one odd ID
+        // is in the tree at any time
+        if(done % 4 == 3)
+        {
+          long long sum = tree.InRange(id, id + 1000);
+          long long evens = evensIn(id, id + 1000, numKeys);
+
+          wrong += sum < evens || sum > evens + 1;
+        }
+        else
+        {
+          int count = tree.Count(id);
+
+          wrong += (id & 1) ? count < 0 || count > 1 : count != 1;
+        }
+
+        done++;
+      }
+
+      reads += done;
+      wrongReads += wrong;
+    }));
+  }
+
+  // The writer keeps inserting and removing odd IDs
+  threads.push_back(thread([&]() {
+    unsigned int state = 12345;
+
+    while(!stop.load(memory_order_relaxed))
+    {
+      AVL::ID id = (nextRandom(state) % numKeys) * 2 + 1;
+
+      tree.Increase(id, 1);
+      tree.Reduce(id, 1);
+    }
+  }));
+
+  this_thread::sleep_for(chrono::milliseconds(millis));
+  stop = true;
+
+  for(size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+
+  return reads / (millis * 1000.0);
+}
+
+int main(int argc, char * argv[])
+{
+  int maxReaders = argc > 1 ? atoi(argv[1]) : max(1u, thread::hardware_concurrency());
+  size_t numKeys = argc > 2 ? atol(argv[2]) : 1 << 20;
+  int millis = argc > 3 ? atoi(argv[3]) : 1000;
+
+  vector<pair<AVL::ID, int> > nodes;
+
+  for(size_t i = 1; i <= numKeys; i++)
+    nodes.push_back(make_pair(AVL::ID(i * 2), 1));
+
+  printf("%-8s %16s %16s\n", "readers", "concurrent Mr/s", "mutex Mr/s");
+
+  for(int readers = 1; readers <= maxReaders; readers++)
+  {
+    double concurrent = run<AVL::ConcurrentTree<AVL::ID, int> >(readers, numKeys, millis, nodes);
+    double locked = run<LockedTree>(readers, numKeys, millis, nodes);
+
+    printf("%-8d %16.2f %16.2f\n", readers, concurrent, locked);
+  }
+
+  if(wrongReads)
+  {
+    printf("fatal: %lld reads returned the wrong answer\n", (long long)wrongReads);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,105 @@
+// The counters are what this measures, so they are always on here
+#ifndef AVL_STATS
+#define AVL_STATS
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include "AVLTree.h"
+
+using namespace std;
+
+// Work done by Increase and Reduce when they add or remove a key: nodes
+// retraced on the way back up and rotations, per operation. A retrace that
+// went all the way to the root would visit as many nodes as the search came
+// down through (the path column). Times include the cost of the counters.
+// usage: retrace [num_keys]
+
+static double pathLength(const AVL::TreeStats & before, const AVL::TreeStats & after)
+{
+  unsigned long long searches = 0, nodes = 0;
+
+  for(int i = 0; i <= AVL::MAX_HEIGHT; i++)
+  {
+    unsigned long long n = after.pathLengths[i] - before.pathLengths[i];
+
+    searches += n;
+    nodes += n * i;
+  }
+
+  return searches ? double(nodes) / searches : 0;
+}
+
+static void report(const char * name, AVL::Tree & tree, const AVL::TreeStats & before,
+    size_t ops, double ns)
+{
+  AVL::TreeStats after = tree.Stats();
+  unsigned long long rotations = 0;
+
+  for(int i = 0; i < AVL::NUM_ROTATIONS; i++)
+    rotations += after.rotations[i] - before.rotations[i];
+
+  printf("%-8s %10zu %10.1f %10.2f %10.2f %10.3f\n", name, ops, ns / ops,
+      pathLength(before, after), double(after.retraced - before.retraced) / ops,
+      double(rotations) / ops);
+}
+
+int main(int argc, char * argv[])
+{
+  size_t numKeys = argc > 1 ? atol(argv[1]) : 1 << 20;
+  typedef chrono::steady_clock clock;
+
+  // Even IDs are inserted in random order and removed again. The odd ones
+  // come and go during the churn
+  vector<AVL::ID> keys, churn;
+
+  for(size_t i = 1; i <= numKeys; i++)
+  {
+    keys.push_back(AVL::ID(i * 2));
+    churn.push_back(AVL::ID(i * 2 - 1));
+  }
+
+  srand(1);
+  random_shuffle(keys.begin(), keys.end());
+  random_shuffle(churn.begin(), churn.end());
+
+  AVL::Tree tree;
+
+  printf("%-8s %10s %10s %10s %10s %10s\n", "op", "ops", "ns/op", "path", "retraced", "rotations");
+
+  AVL::TreeStats before = tree.Stats();
+  clock::time_point start = clock::now();
+
+  for(size_t i = 0; i < keys.size(); i++)
+    tree.Increase(keys[i], 1);
+
+  report("insert", tree, before, keys.size(), chrono::duration<double, nano>(clock::now() - start).count());
+
+  // Each odd key goes in, and an even one comes out. The size stays the same
+  before = tree.Stats();
+  start = clock::now();
+
+  for(size_t i = 0; i < churn.size(); i++)
+  {
+    tree.Increase(churn[i], 1);
+    tree.Reduce(keys[i], 1);
+  }
+
+  report("churn", tree, before, churn.size() * 2, chrono::duration<double, nano>(clock::now() - start).count());
+
+  random_shuffle(churn.begin(), churn.end());
+  before = tree.Stats();
+  start = clock::now();
+
+  for(size_t i = 0; i < churn.size(); i++)
+    tree.Reduce(churn[i], 1);
+
+  report("remove", tree, before, churn.size(), chrono::duration<double, nano>(clock::now() - start).count());
+
+  return 0;
+}
@@ -0,0 +1,128 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "AVLTree.h"
+#include "util.h"
+
+using namespace std;
+
+// Compares starting up from a text tree file (parse, then build) with
+// loading a snapshot of the same tree. Files go in to dir.
+// usage: snapshot [num_keys] [dir]
+
+static double seconds(chrono::steady_clock::time_point start)
+{
+  return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static long long fileSize(const string & path)
+{
+  struct stat info;
+
+  return stat(path.c_str(), &info) == 0 ? info.st_size : -1;
+}
+
+int main(int argc, char * argv[])
+{
+  size_t numKeys = argc > 1 ? atol(argv[1]) : 1 << 22;
+  string dir = argc > 2 ? argv[2] : "/tmp";
+  string textPath = dir + "/bench_tree.txt";
+  string snapPath = dir + "/bench_tree.snap";
+
+  // Random gaps and counts, so neither format gets an easy ride
+  vector<pair<AVL::ID, int> > nodes;
+  AVL::ID id = 0;
+
+  srand(1);
+
+  for(size_t i = 0; i < numKeys; i++)
+  {
+    id += 1 + rand() % 64;
+    nodes.push_back(make_pair(id, 1 + rand() % 1000));
+  }
+
+  FILE * text = fopen(textPath.c_str(), "w");
+
+  if(!text)
+  {
+    printf("fatal: could not write %s\n", textPath.c_str());
+    return 1;
+  }
+
+  fprintf(text, "%zu\n", nodes.size());
+
+  for(size_t i = 0; i < nodes.size(); i++)
+    fprintf(text, "%u %d\n", nodes[i].first, nodes[i].second);
+
+  fclose(text);
+
+  double save;
+
+  {
+    AVL::Tree tree;
+    tree.BuildFromSortedList(nodes);
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+    if(!tree.SaveSnapshot(snapPath.c_str()))
+    {
+      printf("fatal: could not write %s\n", snapPath.c_str());
+      return 1;
+    }
+
+    save = seconds(start);
+  }
+
+  // The files were just written, so both loads read from the page cache
+  double textLoad, snapLoad;
+  long long check = 0;
+
+  {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<pair<AVL::ID, int> > parsed;
+    AVL::Tree tree;
+
+    readTreeFile(textPath.c_str(), parsed);
+    tree.BuildFromSortedList(parsed);
+
+    textLoad = seconds(start);
+    check += tree.Total();
+  }
+
+  {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    AVL::Tree tree;
+
+    if(!tree.LoadSnapshot(snapPath.c_str()))
+    {
+      printf("fatal: could not load %s\n", snapPath.c_str());
+      return 1;
+    }
+
+    snapLoad = seconds(start);
+    check -= tree.Total();
+  }
+
+  if(check != 0)
+  {
+    printf("fatal: the two loads disagree\n");
+    return 1;
+  }
+
+  printf("# keys %zu\n", numKeys);
+  printf("%-10s %12s %12s\n", "format", "bytes", "load ms");
+  printf("%-10s %12lld %12.1f\n", "text", fileSize(textPath), textLoad * 1000);
+  printf("%-10s %12lld %12.1f\n", "snapshot", fileSize(snapPath), snapLoad * 1000);
+  printf("# snapshot save ms %.1f\n", save * 1000);
+
+  unlink(textPath.c_str());
+  unlink(snapPath.c_str());
+
+  return 0;
+}
@@ -0,0 +1,374 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "AVLTree.h"
+
+using namespace std;
+
+// Throughput and latency of every tree operation against std::map, for
+// several key distributions and tree sizes. Prints one CSV row per run so
+// results can be diffed or loaded elsewhere. Sizes go up by 10x from 10^3.
+// usage: suite [max_keys] [num_ops] [impl,...] [dist,...]
+//   impl: avl map       dist: uniform zipf sequential sliding
+
+// std::map with the tree's interface, as the baseline
+struct MapTree
+{
+  typedef map<AVL::ID, int> map_type;
+
+  map_type keys;
+
+  void BuildFromSortedList(const vector<pair<AVL::ID, int> > & list)
+  {
+    keys = map_type(list.begin(), list.end());
+  }
+
+  int Increase(AVL::ID id, int m)
+  {
+    return keys[id] += m;
+  }
+
+  int Reduce(AVL::ID id, int m)
+  {
+    map_type::iterator it = keys.find(id);
+
+    if(it == keys.end())
+      return 0;
+
+    if((it->second -= m) > 0)
+      return it->second;
+
+    keys.erase(it);
+    return 0;
+  }
+
+  int Count(AVL::ID id)
+  {
+    map_type::iterator it = keys.find(id);
+
+    return it == keys.end() ? 0 : it->second;
+  }
+
+  bool Next(AVL::ID id, pair<AVL::ID, int> & result)
+  {
+    map_type::iterator it = keys.upper_bound(id);
+
+    if(it == keys.end())
+      return false;
+
+    result = *it;
+    return true;
+  }
+
+  bool Previous(AVL::ID id, pair<AVL::ID, int> & result)
+  {
+    map_type::iterator it = keys.lower_bound(id);
+
+    if(it == keys.begin())
+      return false;
+
+    result = *--it;
+    return true;
+  }
+
+  // Has to visit every key in the range
+  long long InRange(AVL::ID left, AVL::ID right)
+  {
+    long long sum = 0;
+
+    for(map_type::iterator it = keys.lower_bound(left); it != keys.end() && it->first <= right; ++it)
+      sum += it->second;
+
+    return sum;
+  }
+};
+
+enum op_t { BUILD, INCREASE, REDUCE, COUNT, NEXT, PREVIOUS, INRANGE, NUM_OPS };
+
+static const char * opNames[] = {
+  "build", "increase", "reduce", "count", "next", "previous", "inrange"
+};
+
+enum dist_t { UNIFORM, ZIPF, SEQUENTIAL, SLIDING, NUM_DISTS };
+
+static const char * distNames[] = { "uniform", "zipf", "sequential", "sliding" };
+
+// Width of inrange queries and of the sliding window, in IDs
+static const AVL::ID RANGE_WIDTH = 200;
+static const AVL::ID WINDOW_WIDTH = 4096;
+
+static unsigned long long nextRandom(unsigned long long & state)
+{
+  // xorshift64*
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+
+  return state * 2685821657736338717ull;
+}
+
+/* Zipfian ranks in [0, n) with exponent 0.99, as in YCSB (Gray et al.,
+ * "Quickly generating billion-record synthetic databases"). Setup is O(n),
+ * each draw O(1).
+ */
+class Zipf
+{
+  public:
+    Zipf(size_t n, double theta = 0.99)
+      :n(n), theta(theta)
+    {
+      zetan = 0;
+
+      for(size_t i = 1; i <= n; i++)
+        zetan += 1 / pow(double(i), theta);
+
+      double zeta2 = 1 + 1 / pow(2.0, theta);
+
+      alpha = 1 / (1 - theta);
+      eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+    }
+
+    size_t Next(unsigned long long & state)
+    {
+      double u = (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+      double uz = u * zetan;
+
+      if(uz < 1)
+        return 0;
+
+      if(uz < 1 + pow(0.5, theta))
+        return 1;
+
+      return min(n - 1, size_t(n * pow(eta * u - eta + 1, alpha)));
+    }
+  private:
+    size_t n;
+    double theta, zetan, alpha, eta;
+};
+
+// The tree holds the even IDs 2, 4, ..., 2n, so about half of the IDs
+// drawn are misses (or inserts)
+static vector<AVL::ID> makeKeys(dist_t dist, size_t numKeys, size_t numOps)
+{
+  vector<AVL::ID> keys(numOps);
+  unsigned long long state = 0x9e3779b97f4a7c15ull;
+  AVL::ID span = AVL::ID(numKeys * 2);
+
+  switch(dist)
+  {
+    case UNIFORM:
+      for(size_t i = 0; i < numOps; i++)
+        keys[i] = 1 + nextRandom(state) % span;
+      break;
+    case ZIPF:
+    {
+      Zipf zipf(numKeys);
+
+      // Scatter the popular ranks over the whole tree instead of
+      // bunching them at the low end
+      for(size_t i = 0; i < numOps; i++)
+        keys[i] = 2 * (1 + (zipf.Next(state) * 2654435761ull) % numKeys) - nextRandom(state) % 2;
+      break;
+    }
+    case SEQUENTIAL:
+      for(size_t i = 0; i < numOps; i++)
+        keys[i] = 1 + i % span;
+      break;
+    case SLIDING:
+      // Random keys in a window that moves up by one ID per operation
+      for(size_t i = 0; i < numOps; i++)
+        keys[i] = 1 + (i + nextRandom(state) % WINDOW_WIDTH) % span;
+      break;
+    default:
+      break;
+  }
+
+  return keys;
+}
+
+struct Measurement
+{
+  double nsPerOp;
+  double p50, p99, p999, max;
+};
+
+// Nearest rank percentile of sorted latencies
+static double percentile(const vector<double> & sorted, double p)
+{
+  size_t rank = size_t(ceil(p * sorted.size()));
+
+  return sorted[rank ? rank - 1 : 0];
+}
+
+template <typename TreeT>
+static long long runOp(TreeT & tree, op_t op, AVL::ID key)
+{
+  pair<AVL::ID, int> match;
+
+  switch(op)
+  {
+    case INCREASE:
+      return tree.Increase(key, 1);
+    case REDUCE:
+      return tree.Reduce(key, 1);
+    case COUNT:
+      return tree.Count(key);
+    case NEXT:
+      return tree.Next(key, match) ? match.first : 0;
+    case PREVIOUS:
+      return tree.Previous(key, match) ? match.first : 0;
+    case INRANGE:
+      return tree.InRange(key, key + RANGE_WIDTH);
+    default:
+      return 0;
+  }
+}
+
+template <typename TreeT>
+static Measurement measure(op_t op, const vector<pair<AVL::ID, int> > & nodes,
+    const vector<AVL::ID> & keys, long long & check)
+{
+  typedef chrono::steady_clock clock;
+  Measurement result;
+  vector<double> latencies;
+
+  if(op == BUILD)
+  {
+    // A few builds, each timed as a whole
+    for(int i = 0; i < 5; i++)
+    {
+      TreeT * tree = new TreeT;
+
+      clock::time_point start = clock::now();
+      tree->BuildFromSortedList(nodes);
+      latencies.push_back(chrono::duration<double, nano>(clock::now() - start).count() / nodes.size());
+
+      delete tree;
+    }
+  }
+  else
+  {
+    // Throughput from an untimed run, latencies from a second run on a
+    // fresh tree that times every operation on its own
+    for(int pass = 0; pass < 2; pass++)
+    {
+      TreeT * tree = new TreeT;
+      tree->BuildFromSortedList(nodes);
+
+      if(pass == 0)
+      {
+        clock::time_point start = clock::now();
+
+        for(size_t i = 0; i < keys.size(); i++)
+          check += runOp(*tree, op, keys[i]);
+
+        result.nsPerOp = chrono::duration<double, nano>(clock::now() - start).count() / keys.size();
+      }
+      else
+      {
+        latencies.resize(keys.size());
+
+        for(size_t i = 0; i < keys.size(); i++)
+        {
+          clock::time_point start = clock::now();
+          check += runOp(*tree, op, keys[i]);
+          latencies[i] = chrono::duration<double, nano>(clock::now() - start).count();
+        }
+      }
+
+      delete tree;
+    }
+  }
+
+  sort(latencies.begin(), latencies.end());
+
+  if(op == BUILD)
+    result.nsPerOp = percentile(latencies, 0.5);
+
+  result.p50 = percentile(latencies, 0.5);
+  result.p99 = percentile(latencies, 0.99);
+  result.p999 = percentile(latencies, 0.999);
+  result.max = latencies.back();
+
+  return result;
+}
+
+static bool listed(const char * list, const char * name)
+{
+  if(!list)
+    return true;
+
+  string padded = string(",") + list + ",";
+
+  return padded.find(string(",") + name + ",") != string::npos;
+}
+
+int main(int argc, char * argv[])
+{
+  size_t maxKeys = argc > 1 ? atol(argv[1]) : 1000000;
+  size_t numOps = argc > 2 ? atol(argv[2]) : 1000000;
+  const char * impls = argc > 3 ? argv[3] : NULL;
+  const char * dists = argc > 4 ? argv[4] : NULL;
+  long long check = 0;
+
+  // Latencies include the cost of reading the clock, typically a few
+  // tens of ns. The throughput column doesn't
+  printf("impl,dist,keys,op,ops,ns_per_op,mops_per_s,p50_ns,p99_ns,p999_ns,max_ns\n");
+
+  for(size_t numKeys = 1000; numKeys <= maxKeys; numKeys *= 10)
+  {
+    vector<pair<AVL::ID, int> > nodes;
+
+    // Counts big enough that reduce doesn't empty the tree
+    for(size_t i = 1; i <= numKeys; i++)
+      nodes.push_back(make_pair(AVL::ID(i * 2), 1 << 20));
+
+    for(int dist = 0; dist < NUM_DISTS; dist++)
+    {
+      if(!listed(dists, distNames[dist]))
+        continue;
+
+      vector<AVL::ID> keys = makeKeys(dist_t(dist), numKeys, numOps);
+
+      for(int op = 0; op < NUM_OPS; op++)
+      {
+        // Building doesn't depend on the distribution
+        if(op == BUILD && dist != 0 && !dists)
+          continue;
+
+        for(int impl = 0; impl < 2; impl++)
+        {
+          const char * name = impl == 0 ? "avl" : "map";
+
+          if(!listed(impls, name))
+            continue;
+
+          Measurement m = impl == 0 ?
+              measure<AVL::Tree>(op_t(op), nodes, keys, check) :
+              measure<MapTree>(op_t(op), nodes, keys, check);
+
+          size_t ops = op == BUILD ? numKeys : numOps;
+
+          printf("%s,%s,%zu,%s,%zu,%.1f,%.2f,%.0f,%.0f,%.0f,%.0f\n", name,
+              op == BUILD ? "sorted" : distNames[dist], numKeys, opNames[op], ops,
+              m.nsPerOp, 1000 / m.nsPerOp, m.p50, m.p99, m.p999, m.max);
+          fflush(stdout);
+        }
+      }
+    }
+  }
+
+  // keep the work from being optimized out
+  if(check == 42)
+    fprintf(stderr, " ");
+
+  return 0;
+}
@@ -0,0 +1,69 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "util.h"
+#include "Command.h"
+
+using namespace std;
+
+// Converts text commands (as in test/commands.txt) to the binary command
+// format that bbst --binary reads. With -r, converts binary results back to
+// text so they can be compared against a text mode run.
+int main(int argc, char * argv[])
+{
+  bool results = false;
+
+  if(argc == 2 && strcmp(argv[1], "-r") == 0)
+    results = true;
+  else if(argc != 1)
+  {
+    printf("usage: cmdconv < commands.txt > commands.bin\n");
+    printf("       cmdconv -r < results.bin > results.txt\n");
+    return 1;
+  }
+
+  InputBuffer in(STDIN_FILENO);
+  OutputBuffer out(STDOUT_FILENO);
+
+  if(results)
+  {
+    const char * record;
+    Result result;
+
+    while(in.getBytes(record, BINARY_RESULT_SIZE))
+    {
+      decodeResult(record, result);
+      formatResult(out, result);
+    }
+
+    return 0;
+  }
+
+  const char * line;
+  size_t len;
+  int lineNum = 0;
+  Command cmd;
+
+  while(in.getLine(line, len))
+  {
+    lineNum++;
+
+    if(len == 0)
+      continue;
+
+    if(!parseCommand(line, len, cmd))
+    {
+      out.flush();
+      fprintf(stderr, "fatal: unrecognized command at line %d\n", lineNum);
+      return 1;
+    }
+
+    char record[BINARY_COMMAND_SIZE];
+    encodeCommand(cmd, record);
+    out.putBytes(record, BINARY_COMMAND_SIZE);
+  }
+
+  return 0;
+}
@@ -1,94 +1,348 @@
 #include "util.h"
 
-#include <sstream>
-#include <fstream>
 #include <cstdio>
 #include <cstdlib>
+#include <cassert>
+#include <cstring>
+#include <cerrno>
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
-vector<vector<string> > readInputFile(char * filename)
+// Parses a decimal integer with an optional sign at p and advances p past
+// it. Returns false if there are no digits or the value overflows
+static bool scanInt(const char *& p, const char * end, long long & out)
 {
-  vector<vector<string> > splitlines;
-  ifstream inputFile(filename);
-  string line;
+  bool negative = false;
 
-  if(inputFile.fail())
+  if(p != end && (*p == '-' || *p == '+'))
+    negative = *p++ == '-';
+
+  const char * start = p;
+  unsigned long long value = 0;
+
+  while(p != end && (unsigned char)(*p - '0') < 10)
   {
-      printf("fatal: could not open %s\n", filename);
-      exit(1);
+    value = value * 10 + (*p++ - '0');
+
+    if(value > LLONG_MAX)
+      return false;
   }
 
-  splitlines = readInputFile(dynamic_cast<istream &>(inputFile));
-  inputFile.close();
+  if(p == start)
+    return false;
 
-  return splitlines;
+  out = negative ? -(long long)value : (long long)value;
+  return true;
 }
 
-vector<vector<string> > readInputFile(istream & stream)
+void readTreeFile(const char * filename, vector<pair<unsigned int, int> > & nodes)
 {
-  vector<vector<string> > splitlines;
-  string line;
+  int fd = open(filename, O_RDONLY);
+  struct stat info;
+
+  if(fd < 0 || fstat(fd, &info) < 0)
+  {
+      printf("fatal: could not open %s\n", filename);
+      exit(1);
+  }
 
-  // get N count from beginning of file
-  getline(stream, line);
+  // Map the whole file and scan it in place. An empty file can't be
+  // mapped, but then there is nothing to scan either
+  const char * data = NULL;
+  size_t size = info.st_size;
+
+  if(size > 0)
+  {
+    void * mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
 
-  // string -> integer
-  int items = readInt(line);
+    if(mapping == MAP_FAILED)
+    {
+      printf("fatal: could not map %s\n", filename);
+      exit(1);
+    }
+
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    data = static_cast<const char *>(mapping);
+  }
+
+  close(fd);
+
+  const char * p = data;
+  const char * end = data + size;
+
+  // get N count from beginning of file. Like readInt, anything that
+  // isn't a number means no items
+  long long items = 0;
+
+  while(p != end && (*p == ' ' || *p == '\t'))
+    p++;
+
+  if(!scanInt(p, end, items) || items < 0)
+    items = 0;
+
+  p = static_cast<const char *>(memchr(p, '\n', end - p));
+  p = p ? p + 1 : end;
 
 #ifdef DEBUG
-  printf("Input file has %d items\n", items);
+  printf("Input file has %lld items\n", items);
 #endif
 
-  // read the N items
-  for(int i = 0; i < items; i++)
+  // A line takes at least four bytes, which bounds a bogus header
+  nodes.clear();
+  nodes.reserve(items < (long long)(size / 4) ? items : size / 4);
+
+  unsigned int lastId = 0;
+
+  for(long long i = 0; i < items; i++)
   {
-    if(!stream)
+    if(p == end)
     {
       printf("fatal: stream error when reading\n");
       exit(1);
     }
 
-    getline(stream, line);
-
     // ignore blank lines
-    if(line == "")
+    if(*p == '\n')
     {
+      p++;
       i--;
       continue;
     }
 
-    vector<string> subitems = getTokens(line);
-    splitlines.push_back(subitems);
+    long long id, count;
+
+    // exactly two numbers separated by a single space
+    if(!scanInt(p, end, id) || p == end || *p++ != ' ' || !scanInt(p, end, count))
+    {
+      printf("fatal: malformed node input at line %lld\n", i+1);
+      exit(1);
+    }
+
+    // tolerate trailing spaces and DOS line endings
+    while(p != end && (*p == ' ' || *p == '\r'))
+      p++;
+
+    if(p != end && *p++ != '\n')
+    {
+      printf("fatal: malformed node input at line %lld\n", i+1);
+      exit(1);
+    }
+
+    if(id <= 0 || id > UINT_MAX || count <= 0 || count > INT_MAX)
+    {
+      printf("fatal: malformed node ID(%lld) at line %lld\n", id, i+1);
+      exit(1);
+    }
+
+    if(lastId >= id)
+    {
+      printf("fatal: ID was not strictly increasing at line %lld\n", i+1);
+      exit(1);
+    }
+
+    lastId = id;
+
+    nodes.push_back(pair<unsigned int, int>(id, count));
+  }
+
+  if(data)
+    munmap(const_cast<char *>(data), size);
+}
+
+InputBuffer::InputBuffer(int fd, size_t size)
+  :fd(fd), buffer(new char[size]), size(size), pos(0), used(0), eof(false)
+{
+
+}
+
+InputBuffer::~InputBuffer()
+{
+  delete [] buffer;
+}
+
+bool InputBuffer::fill()
+{
+  if(eof)
+    return false;
+
+  // move the unconsumed tail to the front, growing if it is all tail
+  if(pos > 0)
+  {
+    memmove(buffer, buffer + pos, used - pos);
+    used -= pos;
+    pos = 0;
+  }
+
+  if(used == size)
+  {
+    char * bigger = new char[size * 2];
+    memcpy(bigger, buffer, used);
+    delete [] buffer;
+    buffer = bigger;
+    size *= 2;
+  }
+
+  ssize_t ret;
+
+  do
+  {
+    ret = read(fd, buffer + used, size - used);
+  } while(ret < 0 && errno == EINTR);
+
+  if(ret <= 0)
+  {
+    eof = true;
+    return false;
   }
 
-  return splitlines;
+  used += ret;
+  return true;
 }
 
-vector<string> getTokens(string line)
+bool InputBuffer::getLine(const char *& line, size_t & len)
 {
-    vector<string> subitems;
+  // how much of the unconsumed input is known to have no newline
+  size_t scanned = 0;
 
-    string item;
-    stringstream ss(line);
+  while(true)
+  {
+    const char * newline = static_cast<const char *>(
+        memchr(buffer + pos + scanned, '\n', used - pos - scanned));
 
-    // split input line in to tokens delimited by ' '
-    while(getline(ss, item, ' '))
+    if(newline)
     {
-      subitems.push_back(item);
-      item = "";
+      line = buffer + pos;
+      len = newline - line;
+      pos += len + 1;
+      return true;
     }
 
-    return subitems;
+    scanned = used - pos;
+
+    if(!fill())
+      break;
+  }
+
+  // a final line without a newline
+  if(pos == used)
+    return false;
+
+  line = buffer + pos;
+  len = used - pos;
+  pos = used;
+  return true;
 }
 
-int readInt(string input)
+bool InputBuffer::getBytes(const char *& data, size_t len)
 {
-  stringstream ss;
-  int output = 0;
+  while(used - pos < len)
+  {
+    if(!fill())
+      return false;
+  }
+
+  data = buffer + pos;
+  pos += len;
+  return true;
+}
 
-  ss << input;
-  ss >> output;
+bool InputBuffer::hasLine()
+{
+  return memchr(buffer + pos, '\n', used - pos) != NULL;
+}
+
+bool InputBuffer::hasBytes(size_t len)
+{
+  return used - pos >= len;
+}
+
+OutputBuffer::OutputBuffer(int fd, size_t size)
+  :fd(fd), buffer(new char[size]), size(size), used(0), hook(NULL),
+   hookArg(NULL)
+{
+
+}
+
+OutputBuffer::~OutputBuffer()
+{
+  flush();
+  delete [] buffer;
+}
+
+void OutputBuffer::putInt(long long value)
+{
+  if(value < 0)
+  {
+    putChar('-');
+    // negate in unsigned arithmetic so LLONG_MIN survives
+    putUInt(0ULL - (unsigned long long)value);
+  }
+  else
+  {
+    putUInt(value);
+  }
+}
+
+void OutputBuffer::putUInt(unsigned long long value)
+{
+  // 20 digits holds the largest 64-bit value
+  char digits[20];
+  int len = 0;
+
+  do
+  {
+    digits[len++] = '0' + value % 10;
+    value /= 10;
+  } while(value);
+
+  while(len > 0)
+    putChar(digits[--len]);
+}
+
+void OutputBuffer::putBytes(const char * data, size_t len)
+{
+  assert(len <= size);
+
+  if(size - used < len)
+    flush();
+
+  memcpy(buffer + used, data, len);
+  used += len;
+}
+
+void OutputBuffer::setFlushHook(void (*newHook)(void *), void * arg)
+{
+  hook = newHook;
+  hookArg = arg;
+}
+
+void OutputBuffer::flush()
+{
+  size_t written = 0;
+
+  if(used && hook)
+    hook(hookArg);
+
+  while(written < used)
+  {
+    ssize_t ret = write(fd, buffer + written, used - written);
+
+    if(ret < 0)
+    {
+      if(errno == EINTR)
+        continue;
+
+      // nowhere left to report to
+      exit(1);
+    }
+
+    written += ret;
+  }
 
-  return output;
+  used = 0;
 }
@@ -1,38 +1,88 @@
 #ifndef UTIL_CPP
 #define UTIL_CPP
 
+#include <cstddef>
+#include <utility>
 #include <vector>
-#include <string>
-#include <sstream>
 
-using namespace std;
+// Loads an initial tree file (a count followed by "id count" lines with
+// strictly increasing positive IDs) in to nodes. Exits on malformed input
+void readTreeFile(const char * filename, std::vector<std::pair<unsigned int, int> > & nodes);
 
-vector<vector<string> > readInputFile(char * filename);
-vector<vector<string> > readInputFile(istream & stream);
-vector<string> getTokens(string line);
-int readInt(string input);
-
-template <typename T>
-string join(vector<T> tokens)
+/* Reads a file descriptor in large chunks and hands out lines or fixed
+ * size records that point straight in to the buffer.
+ */
+class InputBuffer
 {
-  stringstream ss;
-  string result;
+  public:
+    InputBuffer(int fd, size_t size = 1 << 20);
+    ~InputBuffer();
+
+    // Returns the next line without its newline. The last line may lack
+    // one. The data stays valid until the next call. False at end of input
+    bool getLine(const char *& line, size_t & len);
+    // Returns the next len bytes. False if fewer than len are left
+    bool getBytes(const char *& data, size_t len);
+
+    // Whether the next line or len bytes can be handed out without
+    // reading (and possibly blocking)
+    bool hasLine();
+    bool hasBytes(size_t len);
+  private:
+    // not copyable
+    InputBuffer(const InputBuffer &);
+    InputBuffer & operator=(const InputBuffer &);
 
-  for(int i = 0; i < tokens.size(); i++)
-  {
-    ss << tokens[i];
+    // Read more input after what is buffered. False at end of input
+    bool fill();
+  private:
+    int fd;
+    char * buffer;
+    size_t size;
+    // unconsumed input is buffer[pos, used)
+    size_t pos;
+    size_t used;
+    bool eof;
+};
+
+/* Collects formatted output and hands it to the kernel in large writes
+ * instead of going through stdio once per line. Flushes on destruction.
+ */
+class OutputBuffer
+{
+  public:
+    OutputBuffer(int fd, size_t size = 1 << 20);
+    ~OutputBuffer();
 
-    result += ss.str();
+    void putInt(long long value);
+    void putUInt(unsigned long long value);
+    void putBytes(const char * data, size_t len);
+    void putChar(char c)
+    {
+      if(used == size)
+        flush();
 
-    if(i+1 != tokens.size())
-      result += " ";
+      buffer[used++] = c;
+    }
 
-    ss.str("");
-    ss.clear();
-  }
+    // Write out everything buffered so far
+    void flush();
 
-  return result;
-}
+    // hook(arg) runs before each write, e.g. to make what is about to be
+    // reported durable first
+    void setFlushHook(void (*hook)(void *), void * arg);
+  private:
+    // not copyable
+    OutputBuffer(const OutputBuffer &);
+    OutputBuffer & operator=(const OutputBuffer &);
+  private:
+    int fd;
+    char * buffer;
+    size_t size;
+    size_t used;
 
+    void (*hook)(void *);
+    void * hookArg;
+};
 
 #endif